@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "apm.h"
+#include "cpu.h"
 
 /* Set u[size] = u[size] + 1, and return the carry. */
 static apm_digit apm_inc(apm_digit *u, apm_size size)
@@ -39,11 +40,19 @@ apm_digit apm_daddi(apm_digit *u, apm_size size, apm_digit v)
     return ((u[0] += v) < v) ? apm_inc(&u[1], size - 1) : 0;
 }
 
-/* Set w[size] = u[size] + v[size] and return the carry. */
 apm_digit apm_add_n(const apm_digit *u,
                     const apm_digit *v,
                     apm_size size,
                     apm_digit *w)
+{
+    return _apm_kernels.add_n(u, v, size, w);
+}
+
+/* Set w[size] = u[size] + v[size] and return the carry. */
+apm_digit _apm_add_n_c(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w)
 {
     ASSERT(u != NULL);
     ASSERT(v != NULL);
@@ -102,11 +111,19 @@ apm_digit apm_addi(apm_digit *u,
     return cy ? apm_inc(u + vsize, usize - vsize) : 0;
 }
 
-/* Set w[size] = u[size] - v[size] and return the borrow. */
 apm_digit apm_sub_n(const apm_digit *u,
                     const apm_digit *v,
                     apm_size size,
                     apm_digit *w)
+{
+    return _apm_kernels.sub_n(u, v, size, w);
+}
+
+/* Set w[size] = u[size] - v[size] and return the borrow. */
+apm_digit _apm_sub_n_c(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w)
 {
     ASSERT(u != NULL);
     ASSERT(v != NULL);
@@ -147,15 +164,7 @@ apm_digit apm_subi_n(apm_digit *u, const apm_digit *v, apm_size size)
     ASSERT(u != NULL);
     ASSERT(v != NULL);
 
-    apm_digit cy = 0;
-    while (size--) {
-        apm_digit vd = *v++;
-        const apm_digit ud = *u;
-        cy = (vd += cy) < cy;
-        cy += (*u -= vd) > ud;
-        ++u;
-    }
-    return cy;
+    return _apm_kernels.sub_n(u, v, size, u);
 }
 
 apm_digit apm_subi(apm_digit *u,
@@ -171,6 +180,23 @@ apm_digit apm_subi(apm_digit *u,
 }
 
 apm_digit apm_dmul(const apm_digit *u, apm_size size, apm_digit v, apm_digit *w)
+{
+    return _apm_kernels.dmul(u, size, v, w);
+}
+
+apm_digit apm_dmul_add(const apm_digit *u,
+                       apm_size size,
+                       apm_digit v,
+                       apm_digit *w)
+{
+    return _apm_kernels.dmul_add(u, size, v, w);
+}
+
+/* Set w[size] = u[size] * v and return the carry. */
+apm_digit _apm_dmul_c(const apm_digit *u,
+                      apm_size size,
+                      apm_digit v,
+                      apm_digit *w)
 {
     if (v <= 1) {
         if (v == 0)
@@ -191,10 +217,11 @@ apm_digit apm_dmul(const apm_digit *u, apm_size size, apm_digit v, apm_digit *w)
     return cy;
 }
 
-apm_digit apm_dmul_add(const apm_digit *u,
-                       apm_size size,
-                       apm_digit v,
-                       apm_digit *w)
+/* Set w[size] = w[size] + u[size] * v and return the carry. */
+apm_digit _apm_dmul_add_c(const apm_digit *u,
+                          apm_size size,
+                          apm_digit v,
+                          apm_digit *w)
 {
     ASSERT(u != NULL);
     ASSERT(w != NULL);
@@ -214,6 +241,30 @@ apm_digit apm_dmul_add(const apm_digit *u,
     return cy;
 }
 
+/* Exact division by 3 [cf. Jebelean, "An algorithm for exact division"].
+ * Since u[size] is known to be a multiple of 3, each quotient digit is the
+ * current digit times the inverse of 3 modulo 2^APM_DIGIT_BITS, and the high
+ * part of 3 * q (at most 2) is carried into the next digit as a borrow.
+ */
+void apm_divexact_by3(apm_digit *u, apm_size size)
+{
+    ASSERT(u != NULL);
+
+    const apm_digit third = APM_DIGIT_MAX / 3;
+    const apm_digit inv = third * 2 + 1; /* 3 * inv = 1 mod 2^BITS */
+    apm_digit cy = 0;
+    while (size--) {
+        const apm_digit ud = *u;
+        const apm_digit s = ud - cy;
+        cy = s > ud;
+        const apm_digit q = s * inv;
+        *u++ = q;
+        cy += (q > third) + (q > third * 2);
+    }
+    ASSERT(cy == 0);
+}
+
+#if !APM_ASM_X86_64
 /* Multiply u[size] by 2^shift and store in v[size], returning carry.
  * shift will be taken modulo APM_DIGIT_BITS. */
 apm_digit apm_lshift(const apm_digit *u,
@@ -240,6 +291,7 @@ apm_digit apm_lshift(const apm_digit *u,
     } while (--size);
     return q;
 }
+#endif
 
 /* Multiply u[size] by 2^shift, shift taken modulo APM_DIGIT_BITS. */
 apm_digit apm_lshifti(apm_digit *u, apm_size size, unsigned int shift)
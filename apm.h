@@ -149,6 +149,20 @@ apm_digit apm_dmul_add(const apm_digit *u,
                        apm_digit v,
                        apm_digit *w);
 
+/* The kernels behind apm_add_n, apm_sub_n, apm_dmul, apm_dmul_add and the
+ * basecase products are chosen at startup for the running processor. Select
+ * another set by name ("generic", plus "x86_64", "adx" and "ifma" on x86-64),
+ * or the best supported one if NAME is NULL; return -1 if it is unknown or not
+ * supported. This is not thread-safe. The APM_CPU environment variable makes
+ * the same choice at startup.
+ */
+int apm_set_cpu(const char *name);
+/* Return the name of the kernel set in use. */
+const char *apm_get_cpu(void);
+
+/* Set u[size] = u[size] / 3, where u[size] MUST be a multiple of 3. */
+void apm_divexact_by3(apm_digit *u, apm_size size);
+
 /* Set w[usize + vsize] = u[usize] * v[vsize]. */
 void apm_mul(const apm_digit *u,
              apm_size usize,
@@ -159,6 +173,78 @@ void apm_mul(const apm_digit *u,
 /* Set v[usize*2] = u[usize]^2. */
 void apm_sqr(const apm_digit *u, apm_size usize, apm_digit *v);
 
+/* Variants of the above for equally sized operands which take all temporary
+ * space of the Karatsuba and Toom-Cook recursion from SCRATCH, whose size in
+ * digits is given by the corresponding _scratch_size function.
+ */
+apm_size apm_mul_n_scratch_size(apm_size size);
+void apm_mul_n_scratch(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w,
+                       apm_digit *scratch);
+apm_size apm_sqr_scratch_size(apm_size size);
+void apm_sqr_scratch(const apm_digit *u,
+                     apm_size size,
+                     apm_digit *v,
+                     apm_digit *scratch);
+
+/* Algorithm used by apm_mul and apm_sqr for operands beyond the Toom-Cook
+ * range. Each backend has its own cutoffs, the ssa_mul/ssa_sqr and
+ * ntt_mul/ntt_sqr fields of apm_thresholds below, which can be changed with
+ * apm_set_thresholds or an APM_TUNE profile.
+ */
+typedef enum {
+    APM_FFT_NONE, /* Stay with Toom-Cook and Karatsuba at any size. */
+    APM_FFT_SSA,  /* Schönhage–Strassen over Z/(2^N+1); the default. */
+    APM_FFT_NTT,  /* Number-theoretic transform modulo three primes. */
+} apm_fft_backend;
+
+/* Select the large-operand multiplication backend. */
+void apm_set_fft_backend(apm_fft_backend backend);
+
+/* Cutoffs between the multiplication algorithms, in digits of the smaller
+ * operand: each algorithm is used from its cutoff up to the next one.
+ */
+typedef struct {
+    apm_size base_sqr;      /* Above this, squaring skips duplicate products. */
+    apm_size karatsuba_mul; /* Karatsuba multiplication. */
+    apm_size karatsuba_sqr; /* Karatsuba squaring. */
+    apm_size toom3_mul;     /* Toom-Cook 3-way multiplication. */
+    apm_size toom3_sqr;     /* Toom-Cook 3-way squaring. */
+    apm_size ssa_mul;       /* Schönhage–Strassen, when selected. */
+    apm_size ssa_sqr;
+    apm_size ntt_mul;       /* Three-prime NTT, when selected. */
+    apm_size ntt_sqr;
+    apm_size parallel;      /* Sub-products on several threads. */
+} apm_thresholds;
+
+/* The cutoffs in effect. */
+extern apm_thresholds _apm_thresholds;
+
+void apm_get_thresholds(apm_thresholds *t);
+/* Install new cutoffs; return -1, changing nothing, if they are out of range.
+ * This is not thread-safe.
+ */
+int apm_set_thresholds(const apm_thresholds *t);
+/* Load or save cutoffs as a profile: lines of "name value", with the field
+ * names above, where '#' starts a comment. Fields not mentioned keep their
+ * value. Return -1 on failure. The APM_TUNE environment variable names a
+ * profile to load at startup.
+ */
+int apm_load_thresholds(const char *path);
+int apm_save_thresholds(const char *path);
+
+/* Let products use up to THREADS threads, counting the caller, or one per
+ * processor if 0: the independent sub-products of Karatsuba and Toom-Cook then
+ * run on a pool of worker threads, down to the "parallel" cutoff. The default
+ * is 1, or the value of the APM_THREADS environment variable. Return -1, with
+ * no pool left, if the threads cannot be started. This MUST NOT be called
+ * while products are running.
+ */
+int apm_set_threads(unsigned int threads);
+unsigned int apm_get_threads(void);
+
 /* Multiply or divide by a power of two, with power taken modulo APM_DIGIT_BITS,
  * and return the carry (left shift) or remainder (right shift). */
 apm_digit apm_lshift(const apm_digit *u,
@@ -168,6 +254,39 @@ apm_digit apm_lshift(const apm_digit *u,
 apm_digit apm_lshifti(apm_digit *u, apm_size size, unsigned int shift);
 apm_digit apm_rshifti(apm_digit *u, apm_size size, unsigned int shift);
 
+/* Receives the next LEN characters of a number being written; returns 0 to
+ * go on, or nonzero to stop.
+ */
+typedef int (*apm_write_fn)(const char *s, size_t len, void *ud);
+/* Write u[size] in a radix on [2,36] to WRITE, in chunks of a fixed size, most
+ * significant first, with no terminating '\0'. The whole text is never held
+ * in memory, and the first chunk goes out before the conversion is done.
+ * Return 0, or the nonzero value WRITE stopped with.
+ */
+int apm_write(const apm_digit *u,
+              apm_size size,
+              unsigned int radix,
+              apm_write_fn write,
+              void *ud);
+
+/* Return the value of the character C as a digit, in either case, or 36 if
+ * it is no digit of any radix up to 36.
+ */
+unsigned int apm_char_value(int c);
+/* Return a size, in digits, which holds any number of LEN characters in a
+ * radix on [2,36].
+ */
+apm_size apm_str_digits(size_t len, unsigned int radix);
+/* Set u to the number written with the LEN characters of S in a radix on
+ * [2,36], which MUST all be digits of it, and return its size. U MUST have
+ * room for apm_str_digits(len, radix) digits. Large numbers are combined by
+ * divide and conquer with apm_mul, in O(M(n) log n) time.
+ */
+apm_size apm_set_str(apm_digit *u,
+                     const char *s,
+                     size_t len,
+                     unsigned int radix);
+
 /* Print u[size] in a radix on [2,36] to the stream fp. No newline is output. */
 void apm_fprint(const apm_digit *u, apm_size size, unsigned int radix, FILE *fp);
 /* Convenience macros for bases 2, 10, and 16, with fp = stdout. */
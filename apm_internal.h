@@ -10,9 +10,72 @@
 #endif
 #endif
 
+/* Tunable parameters: the cutoffs between the multiplication algorithms, in
+ * digits of the smaller operand. "make tune" measures them on the host and
+ * writes apm_tuned.h, which then replaces the defaults below. The cutoffs in
+ * effect live in _apm_thresholds and may be changed at run time as well (see
+ * apm_set_thresholds).
+ */
+#if defined(__has_include)
+#if __has_include("apm_tuned.h")
+#include "apm_tuned.h"
+#endif
+#endif
+
+/* Tunable parameters: below this, squaring uses the multiplication routine. */
+#ifndef BASE_SQR_DEFAULT
+#define BASE_SQR_DEFAULT 10
+#endif
+
 /* Tunable parameters: Karatsuba multiplication and squaring cutoff. */
-#define KARATSUBA_MUL_THRESHOLD 32
-#define KARATSUBA_SQR_THRESHOLD 64
+#ifndef KARATSUBA_MUL_DEFAULT
+#define KARATSUBA_MUL_DEFAULT 32
+#endif
+#ifndef KARATSUBA_SQR_DEFAULT
+#define KARATSUBA_SQR_DEFAULT 64
+#endif
+
+/* Tunable parameters: Toom-Cook 3-way multiplication and squaring cutoff. */
+#ifndef TOOM3_MUL_DEFAULT
+#define TOOM3_MUL_DEFAULT 128
+#endif
+#ifndef TOOM3_SQR_DEFAULT
+#define TOOM3_SQR_DEFAULT 192
+#endif
+
+/* Tunable parameters: Schönhage–Strassen multiplication and squaring cutoff. */
+#ifndef SSA_MUL_DEFAULT
+#define SSA_MUL_DEFAULT 2048
+#endif
+#ifndef SSA_SQR_DEFAULT
+#define SSA_SQR_DEFAULT 2048
+#endif
+
+/* Tunable parameters: three-prime NTT multiplication and squaring cutoff. */
+#ifndef NTT_MUL_DEFAULT
+#define NTT_MUL_DEFAULT 16384
+#endif
+#ifndef NTT_SQR_DEFAULT
+#define NTT_SQR_DEFAULT 8192
+#endif
+
+/* Tunable parameters: products from this size on run their sub-products in
+ * parallel, when there are threads to run them.
+ */
+#ifndef PARALLEL_DEFAULT
+#define PARALLEL_DEFAULT 512
+#endif
+
+#define BASE_SQR_THRESHOLD (_apm_thresholds.base_sqr)
+#define KARATSUBA_MUL_THRESHOLD (_apm_thresholds.karatsuba_mul)
+#define KARATSUBA_SQR_THRESHOLD (_apm_thresholds.karatsuba_sqr)
+#define TOOM3_MUL_THRESHOLD (_apm_thresholds.toom3_mul)
+#define TOOM3_SQR_THRESHOLD (_apm_thresholds.toom3_sqr)
+#define SSA_MUL_THRESHOLD (_apm_thresholds.ssa_mul)
+#define SSA_SQR_THRESHOLD (_apm_thresholds.ssa_sqr)
+#define NTT_MUL_THRESHOLD (_apm_thresholds.ntt_mul)
+#define NTT_SQR_THRESHOLD (_apm_thresholds.ntt_sqr)
+#define PARALLEL_THRESHOLD (_apm_thresholds.parallel)
 
 #if APM_DIGIT_SIZE == 4
 #if defined(i386) || defined(__i386__)
@@ -30,10 +93,20 @@
 #endif
 #endif
 
+/* Hand-written x86-64 kernels in x86_64.c, which cpu.c selects at run time
+ * when the processor supports them. Define APM_NO_ASM to build the portable
+ * versions only.
+ */
+#if APM_DIGIT_SIZE == 8 && (defined(__amd64__) || defined(__x86_64__)) && \
+    !defined(APM_NO_ASM)
+#define APM_ASM_X86_64 1
+#endif
+
 #include "memory.h"
 
-#define APM_TMP_ALLOC(size) apm_new(size)
-#define APM_TMP_FREE(num) apm_free(num)
+#define APM_TMP_ALLOC(size) \
+    ((apm_digit *) apm_tmp_alloc((size_t)(size) *APM_DIGIT_SIZE))
+#define APM_TMP_FREE(num) apm_tmp_free(num)
 #define APM_TMP_COPY(num, size) \
     memcpy(APM_TMP_ALLOC(size), (num), (size) *APM_DIGIT_SIZE)
 
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "apm.h"
+
+/* Compare the large-operand backends of apm_mul and apm_sqr with the
+ * Karatsuba/Toom-Cook ladder they replace.
+ *
+ * Usage: bench [min_digits [max_digits]]
+ * Operand sizes double from min_digits to max_digits; times are the best of
+ * several runs, in microseconds. The peak stack of temporaries follows, with
+ * what the arena holds; it is checked first to hold not much more. Set
+ * APM_CPU to compare the low-level kernel sets, and APM_THREADS to compare
+ * thread counts.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(apm_digit *u, apm_size size, uint64_t seed)
+{
+    for (apm_size i = 0; i < size; i++) {
+        /* xorshift64 */
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        u[i] = (apm_digit) seed;
+    }
+}
+
+/* A large temporary, then a small one on top: the arena MUST hold no more
+ * than a small factor of its peak use. Returns 0, or -1.
+ */
+static int check_arena(void)
+{
+    void *large = apm_tmp_alloc((size_t) 64 << 20);
+    void *small = apm_tmp_alloc(16);
+    struct apm_tmp_stats stats;
+    apm_tmp_get_stats(&stats);
+    apm_tmp_free(small);
+    apm_tmp_free(large);
+    apm_tmp_trim();
+
+    if (stats.reserved > stats.peak + stats.peak / 4) {
+        fprintf(stderr, "arena: %zu KiB reserved for a peak of %zu KiB\n",
+                stats.reserved / 1024, stats.peak / 1024);
+        return -1;
+    }
+    return 0;
+}
+
+static double bench_one(apm_fft_backend backend,
+                        const apm_digit *u,
+                        const apm_digit *v,
+                        apm_size size,
+                        apm_digit *w)
+{
+    apm_set_fft_backend(backend);
+
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        int reps = 0;
+        double elapsed;
+        const double start = now();
+        do {
+            if (u == v)
+                apm_sqr(u, size, w);
+            else
+                apm_mul(u, size, v, size, w);
+            reps++;
+        } while ((elapsed = now() - start) < 0.1);
+        if (run == 0 || elapsed / reps < best)
+            best = elapsed / reps;
+    }
+    return best * 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    apm_size min = argc > 1 ? strtoul(argv[1], NULL, 10) : 1024;
+    apm_size max = argc > 2 ? strtoul(argv[2], NULL, 10) : 65536;
+    if (!min || max < min)
+        return -1;
+    if (check_arena() != 0)
+        return -1;
+
+    apm_digit *u = apm_new(max), *v = apm_new(max), *w = apm_new(max * 2);
+    fill(u, max, 0x9E3779B97F4A7C15);
+    fill(v, max, 0xD1B54A32D192ED03);
+
+    printf("kernels: %s, threads: %u\n", apm_get_cpu(), apm_get_threads());
+    printf("%10s %4s %14s %14s %14s\n", "digits", "op", "toom", "ssa", "ntt");
+    for (apm_size size = min; size <= max; size *= 2) {
+        for (int sqr = 0; sqr < 2; sqr++) {
+            const apm_digit *y = sqr ? u : v;
+            printf("%10u %4s %14.1f %14.1f %14.1f\n", size, sqr ? "sqr" : "mul",
+                   bench_one(APM_FFT_NONE, u, y, size, w),
+                   bench_one(APM_FFT_SSA, u, y, size, w),
+                   bench_one(APM_FFT_NTT, u, y, size, w));
+            fflush(stdout);
+        }
+        if (size > max / 2)
+            break;
+    }
+
+    struct apm_tmp_stats stats;
+    apm_tmp_get_stats(&stats);
+    printf("peak temporaries: %zu KiB, %zu KiB held, %zu chunks allocated\n",
+           stats.peak / 1024, stats.reserved / 1024, stats.chunks);
+
+    apm_free(u);
+    apm_free(v);
+    apm_free(w);
+    return 0;
+}
@@ -1,38 +1,70 @@
+#include <ctype.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 #include "bn.h"
 
-#define BN_MIN_ALLOC(n, s)                                               \
-    do {                                                                 \
-        bn *const __n = (n);                                             \
-        const apm_size __s = (s);                                        \
-        if (__n->alloc < __s) {                                          \
-            __n->digits =                                                \
-                apm_resize(__n->digits, __n->alloc = ((__s + 3) & ~3U)); \
-        }                                                                \
-    } while (0)
+/* Views are never written, nor their digits reallocated. */
+#define BN_WRITABLE(n) ASSERT(!(n)->view)
+
+/* Give N room for SIZE digits, past its allocation, keeping the digits it
+ * has: in N itself while they fit, and on the heap from then on.
+ */
+static void bn_grow(bn *n, apm_size size)
+{
+    if (!n->digits && size <= BN_INLINE_DIGITS) {
+        n->digits = n->small;
+        n->alloc = BN_INLINE_DIGITS;
+        return;
+    }
+
+    const apm_size alloc = (size + 3) & ~3U;
+    if (n->digits == n->small)
+        n->digits = apm_copy(n->small, BN_INLINE_DIGITS, apm_new(alloc));
+    else
+        n->digits = apm_resize(n->digits, alloc);
+    n->alloc = alloc;
+}
 
-#define BN_SIZE(n, s)                                                          \
-    do {                                                                       \
-        bn *const __n = (n);                                                   \
-        __n->size = (s);                                                       \
-        if (__n->alloc < __n->size) {                                          \
-            __n->digits =                                                      \
-                apm_resize(__n->digits, __n->alloc = ((__n->size + 3) & ~3U)); \
-        }                                                                      \
+#define BN_MIN_ALLOC(n, s)        \
+    do {                          \
+        bn *const __n = (n);      \
+        const apm_size __s = (s); \
+        BN_WRITABLE(__n);         \
+        if (__n->alloc < __s)     \
+            bn_grow(__n, __s);    \
     } while (0)
 
-#define BN_INIT_BYTES 8
-#define BN_INIT_DIGITS ((BN_INIT_BYTES + APM_DIGIT_SIZE - 1) / APM_DIGIT_SIZE)
+#define BN_SIZE(n, s)                \
+    do {                             \
+        bn *const __n = (n);         \
+        BN_WRITABLE(__n);            \
+        __n->size = (s);             \
+        if (__n->alloc < __n->size)  \
+            bn_grow(__n, __n->size); \
+    } while (0)
 
 void bn_init(bn *n)
 {
     ASSERT(n != NULL);
 
-    n->alloc = BN_INIT_DIGITS;
-    n->digits = apm_new0(BN_INIT_DIGITS);
+    n->alloc = BN_INLINE_DIGITS;
+    n->digits = apm_zero(n->small, BN_INLINE_DIGITS);
     n->size = 0;
     n->sign = 0;
+    n->view = 0;
+}
+
+void bn_view(bn *n, const apm_digit *digits, apm_size size, unsigned int sign)
+{
+    ASSERT(n != NULL);
+    ASSERT(digits != NULL || size == 0);
+
+    n->digits = (apm_digit *) digits;
+    n->size = apm_rsize(digits, size);
+    n->alloc = size;
+    n->sign = sign && n->size;
+    n->view = 1;
 }
 
 void bn_init_u32(bn *n, uint32_t ui)
@@ -45,10 +77,11 @@ void bn_free(bn *n)
 {
     ASSERT(n != NULL);
 
-    apm_free(n->digits);
+    if (!n->view && n->digits != n->small)
+        apm_free(n->digits);
 }
 
-static void bn_set(bn *p, const bn *q)
+void bn_set(bn *p, const bn *q)
 {
     ASSERT(p != NULL);
     ASSERT(q != NULL);
@@ -100,24 +133,39 @@ void bn_set_u32(bn *n, uint32_t m)
 #endif
 }
 
+void bn_reserve(bn *n, apm_size size)
+{
+    ASSERT(n != NULL);
+
+    BN_MIN_ALLOC(n, size);
+}
+
 void bn_swap(bn *a, bn *b)
 {
     bn tmp = *a;
     *a = *b;
     *b = tmp;
+    /* Inline digits moved along with the rest. */
+    if (a->digits == b->small)
+        a->digits = a->small;
+    if (b->digits == a->small)
+        b->digits = b->small;
 }
 
 #ifndef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
-void bn_add(const bn *a, const bn *b, bn *c)
+/* C = A + B, with B taken to have sign BSIGN. */
+static void bn_add_signed(const bn *a, const bn *b, unsigned int bsign, bn *c)
 {
     if (a->size == 0) {
-        if (b->size == 0)
+        if (b->size == 0) {
             c->size = 0;
-        else
+        } else {
             bn_set(c, b);
+            c->sign = bsign;
+        }
         return;
     } else if (b->size == 0) {
         bn_set(c, a);
@@ -125,12 +173,18 @@ void bn_add(const bn *a, const bn *b, bn *c)
     }
 
     if (a == b) {
+        if (bsign != a->sign) { /* A - A */
+            bn_zero(c);
+            return;
+        }
         apm_digit cy;
         if (a == c) {
+            BN_WRITABLE(c);
             cy = apm_lshifti(c->digits, c->size, 1);
         } else {
             BN_SIZE(c, a->size);
             cy = apm_lshift(a->digits, a->size, 1, c->digits);
+            c->sign = a->sign;
         }
         if (cy) {
             BN_MIN_ALLOC(c, c->size + 1);
@@ -141,7 +195,7 @@ void bn_add(const bn *a, const bn *b, bn *c)
 
     /* Note: it should work for A == C or B == C */
     apm_size size;
-    if (a->sign == b->sign) { /* Both positive or negative. */
+    if (a->sign == bsign) { /* Both positive or negative. */
         size = MAX(a->size, b->size);
         BN_MIN_ALLOC(c, size + 1);
         apm_digit cy =
@@ -151,27 +205,19 @@ void bn_add(const bn *a, const bn *b, bn *c)
         else
             APM_NORMALIZE(c->digits, size);
         c->sign = a->sign;
-    } else { /* Differing signs. */
-        if (a->sign)
-            SWAP(a, b);
-
-        ASSERT(a->sign == 0);
-        ASSERT(b->sign == 1);
-
+    } else { /* Differing signs: the larger magnitude gives the sign. */
         int cmp = apm_cmp(a->digits, a->size, b->digits, b->size);
-        if (cmp > 0) { /* |A| > |B| */
-            /* If B < 0 and |A| > |B|, then C = A - |B| */
+        if (cmp > 0) { /* |A| > |B|: C = sign(A) * (|A| - |B|) */
             BN_MIN_ALLOC(c, a->size);
             ASSERT(apm_sub(a->digits, a->size, b->digits, b->size, c->digits) ==
                    0);
-            c->sign = 0;
+            c->sign = a->sign;
             size = apm_rsize(c->digits, a->size);
-        } else if (cmp < 0) { /* |A| < |B| */
-            /* If B < 0 and |A| < |B|, then C = -(|B| - |A|) */
+        } else if (cmp < 0) { /* |A| < |B|: C = sign(B) * (|B| - |A|) */
             BN_MIN_ALLOC(c, b->size);
             ASSERT(apm_sub(b->digits, b->size, a->digits, a->size, c->digits) ==
                    0);
-            c->sign = 1;
+            c->sign = bsign;
             size = apm_rsize(c->digits, b->size);
         } else { /* |A| = |B| */
             c->sign = 0;
@@ -181,6 +227,16 @@ void bn_add(const bn *a, const bn *b, bn *c)
     c->size = size;
 }
 
+void bn_add(const bn *a, const bn *b, bn *c)
+{
+    bn_add_signed(a, b, b->sign, c);
+}
+
+void bn_sub(const bn *a, const bn *b, bn *c)
+{
+    bn_add_signed(a, b, !b->sign, c);
+}
+
 void bn_mul(const bn *a, const bn *b, bn *c)
 {
     if (a->size == 0 || b->size == 0) {
@@ -234,6 +290,30 @@ void bn_sqr(const bn *a, bn *b)
     b->sign = 0;
 }
 
+void bn_mul_ws(const bn *a, const bn *b, bn *c, bn *w)
+{
+    ASSERT(w != a && w != b && w != c);
+
+    if (a == c || b == c) {
+        bn_mul(a, b, w);
+        bn_swap(c, w);
+    } else {
+        bn_mul(a, b, c);
+    }
+}
+
+void bn_sqr_ws(const bn *a, bn *b, bn *w)
+{
+    ASSERT(w != a && w != b);
+
+    if (a == b) {
+        bn_sqr(a, w);
+        bn_swap(b, w);
+    } else {
+        bn_sqr(a, b);
+    }
+}
+
 void bn_lshift(const bn *p, unsigned int bits, bn *q)
 {
     if (bits == 0 || bn_is_zero(p)) {
@@ -249,6 +329,7 @@ void bn_lshift(const bn *p, unsigned int bits, bn *q)
 
     apm_digit cy;
     if (p == q) {
+        BN_WRITABLE(q);
         cy = apm_lshifti(q->digits, q->size, bits);
         if (digits != 0) {
             BN_MIN_ALLOC(q, q->size + digits);
@@ -280,3 +361,69 @@ void bn_fprint(const bn *n, unsigned int base, FILE *fp)
         fputc('-', fp);
     apm_fprint(n->digits, n->size, base, fp);
 }
+
+int bn_fprint_stream(const bn *n,
+                     unsigned int base,
+                     apm_write_fn write,
+                     void *ud)
+{
+    if (n->size == 0)
+        return write("0", 1, ud);
+    if (n->sign) {
+        const int ret = write("-", 1, ud);
+        if (ret)
+            return ret;
+    }
+    return apm_write(n->digits, n->size, base, write, ud);
+}
+
+int bn_set_str(bn *n, const char *s, unsigned int base)
+{
+    ASSERT(n != NULL);
+    ASSERT(s != NULL);
+    ASSERT(base >= 2 && base <= 36);
+
+    const bool neg = *s == '-';
+    s += neg;
+    size_t len = 0;
+    while (s[len] && apm_char_value((unsigned char) s[len]) < base)
+        ++len;
+    if (!len || s[len])
+        return -1;
+
+    BN_MIN_ALLOC(n, apm_str_digits(len, base));
+    n->size = apm_set_str(n->digits, s, len, base);
+    n->sign = neg && n->size;
+    return 0;
+}
+
+int bn_fscan(bn *n, unsigned int base, FILE *fp)
+{
+    ASSERT(n != NULL);
+    ASSERT(base >= 2 && base <= 36);
+
+    int c;
+    do
+        c = getc(fp);
+    while (isspace(c));
+
+    size_t len = 0, alloc = 64;
+    char *s = MALLOC(alloc);
+    if (c == '-') {
+        s[len++] = c;
+        c = getc(fp);
+    }
+    while (c != EOF && apm_char_value(c) < base) {
+        if (len + 1 == alloc)
+            s = REALLOC(s, alloc *= 2);
+        s[len++] = c;
+        c = getc(fp);
+    }
+    if (c != EOF)
+        ungetc(c, fp);
+    s[len] = '\0';
+
+    const int ret = bn_set_str(n, s, base);
+    FREE(s);
+    return ret;
+}
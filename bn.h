@@ -11,18 +11,28 @@
 extern "C" {
 #endif
 
+/* Numbers up to this size are kept in the bn itself, and need no heap. */
+#define BN_INLINE_BYTES 16
+#define BN_INLINE_DIGITS \
+    ((BN_INLINE_BYTES + APM_DIGIT_SIZE - 1) / APM_DIGIT_SIZE)
+
+/* DIGITS may point into the bn itself, so a bn is never copied by value;
+ * use bn_set or bn_swap.
+ */
 typedef struct {
-    apm_digit *digits; /* Digits of number. */
+    apm_digit *digits; /* Digits of number: SMALL, or on the heap. */
     apm_size size;     /* Length of number. */
     apm_size alloc;    /* Size of allocation. */
     unsigned sign : 1; /* Sign bit. */
+    unsigned view : 1; /* Digits are borrowed (see bn_view). */
+    apm_digit small[BN_INLINE_DIGITS]; /* Digits of short numbers. */
 } bn, bn_t[1];
 
-#define BN_INITIALIZER                                        \
-    {                                                         \
-        {                                                     \
-            .digits = NULL, .size = 0, .alloc = 0, .sign = 0, \
-        }                                                     \
+#define BN_INITIALIZER                                                   \
+    {                                                                    \
+        {                                                                \
+            .digits = NULL, .size = 0, .alloc = 0, .sign = 0, .view = 0, \
+        }                                                                \
     }
 
 void bn_init(bn *p);
@@ -31,6 +41,21 @@ void bn_free(bn *p);
 
 void bn_set_u32(bn *p, uint32_t q);
 
+/* Make P a read-only view of the SIZE digits at DIGITS, least significant
+ * first, which stay with the caller, e.g. in shared memory or a message
+ * buffer, and must outlive P. P need not be initialized. It may be an input
+ * of any operation, but never a result, and bn_free leaves the digits alone.
+ */
+void bn_view(bn *p, const apm_digit *digits, apm_size size, unsigned int sign);
+
+/* P = Q */
+void bn_set(bn *p, const bn *q);
+
+/* Make room for SIZE digits, so that results up to that size need no
+ * reallocation.
+ */
+void bn_reserve(bn *p, apm_size size);
+
 #define bn_is_zero(n) ((n)->size == 0)
 void bn_zero(bn *p);
 
@@ -41,13 +66,69 @@ void bn_lshift(const bn *p, unsigned int bits, bn *q);
 /* S = A + B */
 void bn_add(const bn *a, const bn *b, bn *s);
 
+/* D = A - B */
+void bn_sub(const bn *a, const bn *b, bn *d);
+
 /* P = A * B */
 void bn_mul(const bn *a, const bn *b, bn *p);
 
 /* B = A * A */
 void bn_sqr(const bn *a, bn *b);
 
+/* As bn_mul and bn_sqr, for a result which may also be an input, as in
+ * P = P * A. bn_mul and bn_sqr compute such a product aside and copy it
+ * back; these compute it in W instead and swap it in, leaving W with the
+ * former digits of the result. A W kept across calls so saves the copy and,
+ * once grown, the allocation. W is no input nor result, and its value is
+ * lost.
+ */
+void bn_mul_ws(const bn *a, const bn *b, bn *p, bn *w);
+void bn_sqr_ws(const bn *a, bn *b, bn *w);
+
 void bn_fprint(const bn *n, unsigned int base, FILE *fp);
+
+/* Set P to the number in BASE on [2,36] written at S, with an optional
+ * leading '-', and digits past 9 in either case. Return 0, or -1, with P
+ * unchanged, if S is anything else.
+ */
+int bn_set_str(bn *p, const char *s, unsigned int base);
+
+/* Read P in BASE from FP: white space is skipped, then an optional '-' and
+ * the digits are read up to the first character which is no digit, which is
+ * left in the stream. Return 0, or -1, with P unchanged, if there is no
+ * number.
+ */
+int bn_fscan(bn *p, unsigned int base, FILE *fp);
+#define bn_scan(n, base) bn_fscan((n), (base), stdin)
+
+/* Write N to FP in a binary form: a versioned header, which tells the byte
+ * order and digit size of this host, and the raw digits. Return 0 or -1.
+ */
+int bn_write(const bn *n, FILE *fp);
+
+/* Read N from FP, as written by bn_write on any host. Return 0, or -1, with
+ * N unchanged, if FP holds no such number.
+ */
+int bn_read(bn *n, FILE *fp);
+
+/* Make N a read-only view of the number written by bn_write to the file
+ * PATH, with its digits mapped in place rather than read: a file of any
+ * size loads at once, and its pages are read as they are used. N is a view
+ * as with bn_view, and the mapping is released with bn_view_unmap. Return
+ * -1 if the file cannot be mapped, or was written by a host of another byte
+ * order or digit size; bn_read still loads those.
+ */
+int bn_view_mmap(bn *n, const char *path);
+void bn_view_unmap(bn *n);
+
+/* Write N in BASE to WRITE, in chunks of characters in order, with no
+ * terminating '\0' (see apm_write). Return 0, or the nonzero value WRITE
+ * stopped with.
+ */
+int bn_fprint_stream(const bn *n,
+                     unsigned int base,
+                     apm_write_fn write,
+                     void *ud);
 #define bn_print(n, base) bn_fprint((n), (base), stdout)
 #define bn_print_dec(n) bn_print((n), 10)
 #define bn_print_hex(n) bn_print((n), 16)
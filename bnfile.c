@@ -0,0 +1,161 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bn.h"
+
+/* The binary form of a bn: a header, then its digits from the least
+ * significant up, each as the writer holds it in memory. The header tells the
+ * byte order and digit size of the writer, so any host reads the file back;
+ * one of the same kind maps it and uses the digits in place.
+ */
+
+#define BN_FILE_MAGIC "BNUM"
+#define BN_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t digit_size; /* In bytes. */
+    uint8_t big_endian;
+    uint8_t sign;
+    uint64_t size; /* Digits which follow, in the byte order above. */
+} bn_file_header;
+
+static bool host_big_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const uint8_t *) &one == 0;
+}
+
+static uint64_t bswap_if(uint64_t x, bool swap)
+{
+    return swap ? __builtin_bswap64(x) : x;
+}
+
+/* Check H, and return its digit count in host order, or -1. */
+static int64_t bn_file_check(const bn_file_header *h)
+{
+    if (memcmp(h->magic, BN_FILE_MAGIC, sizeof(h->magic)) ||
+        h->version != BN_FILE_VERSION ||
+        (h->digit_size != 4 && h->digit_size != 8) || h->big_endian > 1 ||
+        h->sign > 1)
+        return -1;
+    const uint64_t size = bswap_if(h->size, h->big_endian != host_big_endian());
+    /* The size in host digits must fit an apm_size. */
+    if (size > (uint64_t) (apm_size) -1 * APM_DIGIT_SIZE / h->digit_size)
+        return -1;
+    return size;
+}
+
+int bn_write(const bn *n, FILE *fp)
+{
+    ASSERT(n != NULL);
+
+    const bn_file_header h = {
+        BN_FILE_MAGIC, BN_FILE_VERSION,     APM_DIGIT_SIZE,
+        host_big_endian(), n->size && n->sign, n->size,
+    };
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+        fwrite(n->digits, APM_DIGIT_SIZE, n->size, fp) != n->size)
+        return -1;
+    return 0;
+}
+
+int bn_read(bn *n, FILE *fp)
+{
+    ASSERT(n != NULL);
+
+    bn_file_header h;
+    if (fread(&h, sizeof(h), 1, fp) != 1)
+        return -1;
+    const int64_t count = bn_file_check(&h);
+    if (count < 0)
+        return -1;
+
+    const size_t ds = h.digit_size;
+    const size_t bytes = count * ds;
+    const apm_size size = (bytes + APM_DIGIT_SIZE - 1) / APM_DIGIT_SIZE;
+    apm_digit *digits = apm_new(size ? size : 1);
+
+    if (ds == APM_DIGIT_SIZE && h.big_endian == host_big_endian()) {
+        if (fread(digits, ds, count, fp) != (size_t) count) {
+            apm_free(digits);
+            return -1;
+        }
+    } else {
+        /* Another kind of host: put the bytes of its digits together in
+         * ours, from the least significant one up. */
+        uint8_t *buf = MALLOC(bytes ? bytes : 1);
+        if (fread(buf, 1, bytes, fp) != bytes) {
+            FREE(buf);
+            apm_free(digits);
+            return -1;
+        }
+        apm_zero(digits, size);
+        for (size_t i = 0; i < bytes; i++) {
+            const size_t j = h.big_endian ? i / ds * ds + (ds - 1 - i % ds) : i;
+            digits[i / APM_DIGIT_SIZE] |= (apm_digit) buf[j]
+                                          << (8 * (i % APM_DIGIT_SIZE));
+        }
+        FREE(buf);
+    }
+
+    bn_free(n);
+    n->digits = digits;
+    n->alloc = size ? size : 1;
+    n->size = apm_rsize(digits, size);
+    n->sign = h.sign && n->size;
+    n->view = 0;
+    return 0;
+}
+
+/* The mapping starts with the header, right before the digits of the view,
+ * whose alloc counts the digits of the file.
+ */
+int bn_view_mmap(bn *n, const char *path)
+{
+    ASSERT(n != NULL);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    bn_file_header h;
+    int64_t count = -1;
+    if (fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == sizeof(h))
+        count = bn_file_check(&h);
+    /* Only the digits of this kind of host are usable in place. */
+    if (count < 0 || h.digit_size != APM_DIGIT_SIZE ||
+        h.big_endian != host_big_endian() ||
+        (uint64_t) st.st_size != sizeof(h) + count * APM_DIGIT_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    bn_view(n, (const apm_digit *) ((const char *) map + sizeof(h)), count,
+            h.sign);
+    return 0;
+}
+
+void bn_view_unmap(bn *n)
+{
+    ASSERT(n != NULL);
+    ASSERT(n->view);
+
+    munmap((char *) n->digits - sizeof(bn_file_header),
+           sizeof(bn_file_header) + (size_t) n->alloc * APM_DIGIT_SIZE);
+    n->digits = NULL;
+    n->size = n->alloc = 0;
+    n->view = 0;
+}
@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "apm.h"
+#include "cpu.h"
+
+#if APM_ASM_X86_64
+#include <cpuid.h>
+#endif
+
+/* Run-time selection of the low-level kernels.
+ *
+ * A single binary may run on processors with different instruction set
+ * extensions, so every kernel set is built in, and the most capable one the
+ * processor supports is installed before main() runs. The environment variable
+ * APM_CPU names a set to use instead, e.g. APM_CPU=generic, which is handy to
+ * compare them.
+ */
+
+#define GENERIC_KERNELS                                                  \
+    {                                                                    \
+        "generic", _apm_add_n_c, _apm_sub_n_c, _apm_dmul_c,              \
+            _apm_dmul_add_c, _apm_mul_base_c, _apm_sqr_base_c,           \
+            _apm_sqr_diag_c,                                             \
+    }
+
+/* Portable until the constructor below has run. */
+apm_kernels _apm_kernels = GENERIC_KERNELS;
+
+#if APM_ASM_X86_64
+static bool cpu_has_adx(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ebx & bit_BMI2) && (ebx & bit_ADX);
+}
+
+/* AVX-512 IFMA, on top of ADX, and an OS which saves the AVX-512 state. */
+static bool cpu_has_ifma(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!cpu_has_adx() || !__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & bit_OSXSAVE))
+        return false;
+    /* XCR0: SSE, AVX, opmask, and both halves of the upper ZMM state. */
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0xe6) != 0xe6)
+        return false;
+    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+    return (ebx & bit_AVX512F) && (ebx & bit_AVX512IFMA);
+}
+#endif
+
+/* Kernel sets in increasing order of preference. */
+static const struct {
+    apm_kernels kernels;
+    bool (*supported)(void); /* NULL if always supported. */
+} cpu_variants[] = {
+    {GENERIC_KERNELS, NULL},
+#if APM_ASM_X86_64
+    {{"x86_64", _apm_add_n_x86_64, _apm_sub_n_x86_64, _apm_dmul_c,
+      _apm_dmul_add_c, _apm_mul_base_c, _apm_sqr_base_c, _apm_sqr_diag_c},
+     NULL},
+    {{"adx", _apm_add_n_x86_64, _apm_sub_n_x86_64, _apm_dmul_adx,
+      _apm_dmul_add_adx, _apm_mul_base_c, _apm_sqr_base_c,
+      _apm_sqr_diag_bmi2},
+     cpu_has_adx},
+    {{"ifma", _apm_add_n_x86_64, _apm_sub_n_x86_64, _apm_dmul_adx,
+      _apm_dmul_add_adx, _apm_mul_base_ifma, _apm_sqr_base_ifma,
+      _apm_sqr_diag_bmi2},
+     cpu_has_ifma},
+#endif
+};
+
+#define N_VARIANTS (sizeof(cpu_variants) / sizeof(cpu_variants[0]))
+
+int apm_set_cpu(const char *name)
+{
+    for (size_t i = N_VARIANTS; i--;) {
+        if (name && strcmp(name, cpu_variants[i].kernels.name))
+            continue;
+        if (cpu_variants[i].supported && !cpu_variants[i].supported())
+            continue;
+        _apm_kernels = cpu_variants[i].kernels;
+        return 0;
+    }
+    return -1;
+}
+
+const char *apm_get_cpu(void)
+{
+    return _apm_kernels.name;
+}
+
+__attribute__((constructor)) static void apm_cpu_init(void)
+{
+    const char *name = getenv("APM_CPU");
+    if (name && *name && apm_set_cpu(name) == 0)
+        return;
+    if (name && *name)
+        fprintf(stderr, "APM_CPU=%s is not available here, ignored.\n", name);
+    apm_set_cpu(NULL);
+}
@@ -0,0 +1,94 @@
+/* Low-level kernels with several implementations, of which the fastest one
+ * the processor supports is selected at startup (see cpu.c).
+ */
+
+#ifndef _APM_CPU_H_
+#define _APM_CPU_H_
+
+#include "apm.h"
+
+typedef struct {
+    const char *name;
+    apm_digit (*add_n)(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w);
+    apm_digit (*sub_n)(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w);
+    apm_digit (*dmul)(const apm_digit *u,
+                      apm_size size,
+                      apm_digit v,
+                      apm_digit *w);
+    apm_digit (*dmul_add)(const apm_digit *u,
+                          apm_size size,
+                          apm_digit v,
+                          apm_digit *w);
+    /* Long multiplication, usize >= vsize. */
+    void (*mul_base)(const apm_digit *u,
+                     apm_size usize,
+                     const apm_digit *v,
+                     apm_size vsize,
+                     apm_digit *w);
+    /* Schoolbook squaring. */
+    void (*sqr_base)(const apm_digit *u, apm_size size, apm_digit *v);
+    /* Add the squares of the digits of u[size] onto v[2 * size]. */
+    void (*sqr_diag)(const apm_digit *u, apm_size size, apm_digit *v);
+} apm_kernels;
+
+/* The kernels in use. */
+extern apm_kernels _apm_kernels;
+
+/* Portable implementations. */
+apm_digit _apm_add_n_c(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w);
+apm_digit _apm_sub_n_c(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w);
+apm_digit _apm_dmul_c(const apm_digit *u,
+                      apm_size size,
+                      apm_digit v,
+                      apm_digit *w);
+apm_digit _apm_dmul_add_c(const apm_digit *u,
+                          apm_size size,
+                          apm_digit v,
+                          apm_digit *w);
+void _apm_mul_base_c(const apm_digit *u,
+                     apm_size usize,
+                     const apm_digit *v,
+                     apm_size vsize,
+                     apm_digit *w);
+void _apm_sqr_base_c(const apm_digit *u, apm_size size, apm_digit *v);
+void _apm_sqr_diag_c(const apm_digit *u, apm_size size, apm_digit *v);
+
+#if APM_ASM_X86_64
+apm_digit _apm_add_n_x86_64(const apm_digit *u,
+                            const apm_digit *v,
+                            apm_size size,
+                            apm_digit *w);
+apm_digit _apm_sub_n_x86_64(const apm_digit *u,
+                            const apm_digit *v,
+                            apm_size size,
+                            apm_digit *w);
+apm_digit _apm_dmul_adx(const apm_digit *u,
+                        apm_size size,
+                        apm_digit v,
+                        apm_digit *w);
+apm_digit _apm_dmul_add_adx(const apm_digit *u,
+                            apm_size size,
+                            apm_digit v,
+                            apm_digit *w);
+void _apm_sqr_diag_bmi2(const apm_digit *u, apm_size size, apm_digit *v);
+void _apm_mul_base_ifma(const apm_digit *u,
+                        apm_size usize,
+                        const apm_digit *v,
+                        apm_size vsize,
+                        apm_digit *w);
+void _apm_sqr_base_ifma(const apm_digit *u, apm_size size, apm_digit *v);
+#endif
+
+#endif /* !_APM_CPU_H_ */
@@ -0,0 +1,323 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fib.h"
+#include "pool.h"
+
+/* Digits of F_n, with room for the intermediate values of the ladders:
+ * log2((1 + sqrt(5)) / 2) < 0.6943.
+ */
+static apm_size fib_digits(uint64_t n)
+{
+    return (apm_size) (n * 0.6943 / APM_DIGIT_BITS) + 4;
+}
+
+/* A product of a ladder step, C = A * B, or a square if A == B. */
+typedef struct {
+    const bn *a, *b;
+    bn *c;
+} fib_op;
+
+static void fib_op_run(void *arg)
+{
+    fib_op *op = arg;
+    bn_mul(op->a, op->b, op->c);
+}
+
+/* Compute the N independent products of a ladder step. With several threads
+ * (see apm_set_threads) and large enough operands, they run at the same
+ * time, on the pool which also runs the sub-products within each of them.
+ * The results should have their room reserved (see bn_reserve), so that the
+ * threads do not wait on the allocator in every step.
+ */
+static void fib_products(fib_op *ops, unsigned int n)
+{
+    if (!_apm_parallel_wanted(ops[0].a->size)) {
+        for (unsigned int i = 0; i < n; i++)
+            fib_op_run(&ops[i]);
+        return;
+    }
+
+    apm_task tasks[3];
+    ASSERT(n <= 3);
+    for (unsigned int i = 1; i < n; i++)
+        _apm_task_spawn(&tasks[i], fib_op_run, &ops[i]);
+    fib_op_run(&ops[0]);
+    for (unsigned int i = n; --i > 0;)
+        _apm_task_wait(&tasks[i]);
+}
+
+/* Compute the Nth Fibonnaci number F_n, where
+ * F_0 = 0
+ * F_1 = 1
+ * F_n = F_{n-1} + F_{n-2} for n >= 2.
+ *
+ * This is based on the matrix identity:
+ *        n
+ * [ 0 1 ]  = [ F_{n-1}    F_n   ]
+ * [ 1 1 ]    [   F_n    F_{n+1} ]
+ *
+ * Exponentiation uses binary power algorithm from high bit to low bit.
+ */
+void fib_matrix(uint64_t n, bn *fib)
+{
+    if (unlikely(n <= 2)) {
+        if (n == 0)
+            bn_zero(fib);
+        else
+            bn_set_u32(fib, 1);
+        return;
+    }
+
+    bn *a1 = fib; /* Use output param fib as a1 */
+
+    bn_t a0, tmp, a, sq, prod;
+    bn_init_u32(a0, 0); /*  a0 = 0 */
+    bn_set_u32(a1, 1);  /*  a1 = 1 */
+    bn_init(tmp);       /* tmp = 0 */
+    bn_init(a);
+    bn_init(sq);
+    bn_init(prod);
+
+    /* Every value fits in the room of F_n, so the loop never reallocates. */
+    const apm_size size = fib_digits(n);
+    bn *all[] = {a0, a1, tmp, a, sq, prod};
+    for (unsigned int i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+        bn_reserve(all[i], size);
+
+    /* Start at second-highest bit set. */
+    for (uint64_t k = ((uint64_t) 1) << (62 - __builtin_clzll(n)); k; k >>= 1) {
+        /* Both ways use two squares, two adds, one multipy and one shift.
+         * The three products are independent. */
+        bn_lshift(a0, 1, a); /* a03 = a0 * 2 */
+        bn_add(a, a1, a);    /*   ... + a1 */
+        fib_op ops[3] = {
+            {a1, a, prod}, /* prod = a1 * a */
+            {a1, a1, tmp}, /*  tmp = a1^2 */
+            {a0, a0, sq},  /*   sq = a0^2 */
+        };
+        fib_products(ops, 3);
+        bn_add(sq, tmp, a0); /* a0 = a0 * a0 + a1 * a1 */
+        bn_swap(a1, prod);   /* a1 = a1 * a */
+        if (k & n) {
+            bn_swap(a1, a0);    /*  a1 <-> a0 */
+            bn_add(a0, a1, a1); /*  a1 += a0 */
+        }
+    }
+    /* Now a1 (alias of output parameter fib) = F[n] */
+
+    bn_free(a0);
+    bn_free(tmp);
+    bn_free(a);
+    bn_free(sq);
+    bn_free(prod);
+}
+
+/* Fast doubling with squares only [cf. GMP, mpz/fib_ui.c]:
+ * F_{2k+1} = 4F_k^2 - F_{k-1}^2 + 2(-1)^k
+ * F_{2k-1} = F_k^2 + F_{k-1}^2
+ * F_{2k}   = F_{2k+1} - F_{2k-1}
+ *
+ * From (F_k, F_{k-1}) in (F1, F0), set (G1, G0) to (F_{2k}, F_{2k-1}) if BIT
+ * is clear, or to (F_{2k+1}, F_{2k}) if it is set; ODD tells the parity of
+ * k. G1 and G0 may be F1 and F0. The product of the matrix form,
+ * F_k * (2F_{k-1} + F_k), is traded for additions, which saves about a third
+ * of the multiplication work.
+ */
+static void fib_double(const bn *f1,
+                       const bn *f0,
+                       bool odd,
+                       bool bit,
+                       bn *g1,
+                       bn *g0,
+                       bn *s,
+                       bn *t)
+{
+    static const apm_digit two_digit = 2;
+    bn_t two;
+    bn_view(two, &two_digit, 1, odd);
+
+    fib_op ops[2] = {
+        {f1, f1, s}, /* s = F_k^2 */
+        {f0, f0, t}, /* t = F_{k-1}^2 */
+    };
+    fib_products(ops, 2);
+    bn_add(s, t, g0);     /* g0 = F_{2k-1} */
+    bn_lshift(s, 2, s);   /*  s = 4F_k^2 */
+    bn_sub(s, t, g1);     /* g1 = 4F_k^2 - F_{k-1}^2 */
+    bn_add(g1, two, g1); /* ... + 2(-1)^k = F_{2k+1} */
+    if (bit)
+        bn_sub(g1, g0, g0); /* g0 = F_{2k} */
+    else
+        bn_sub(g1, g0, g1); /* g1 = F_{2k} */
+}
+
+void fib_ladder(uint64_t n,
+                unsigned int from,
+                unsigned int to,
+                bn *f1,
+                bn *f0)
+{
+    ASSERT(to <= from && from < 64);
+
+    bn_t s, t;
+    bn_init(s);
+    bn_init(t);
+
+    /* Every value fits in the room of F_{n >> to}, so the loop never
+     * reallocates. */
+    const apm_size size = fib_digits(n >> to);
+    bn_reserve(f1, size);
+    bn_reserve(f0, size);
+    bn_reserve(s, size);
+    bn_reserve(t, size);
+
+    for (unsigned int depth = from; depth > to; depth--) {
+        const uint64_t k = n >> (depth - 1);
+        fib_double(f1, f0, (k >> 1) & 1, k & 1, f1, f0, s, t);
+    }
+
+    bn_free(s);
+    bn_free(t);
+}
+
+/* Fast doubling from (F_1, F_0), from high bit to low bit of n. */
+void fib_doubling(uint64_t n, bn *fib)
+{
+    if (unlikely(n <= 2)) {
+        if (n == 0)
+            bn_zero(fib);
+        else
+            bn_set_u32(fib, 1);
+        return;
+    }
+
+    bn *f1 = fib; /* F_k, in the output param */
+
+    bn_t f0;
+    bn_set_u32(f1, 1);  /* F_1 = 1 */
+    bn_init_u32(f0, 0); /* F_0 = 0 */
+
+    /* Start at second-highest bit set. */
+    fib_ladder(n, 63 - __builtin_clzll(n), 0, f1, f0);
+    /* Now f1 (alias of output parameter fib) = F[n] */
+
+    bn_free(f0);
+}
+
+/* Largest gap between two requested indices which fib_batch crosses with
+ * additions, one per index, rather than with the ladder. A ladder from a
+ * shared prefix still ends with two squares of half the size of F_n, which
+ * cost as much as this many additions at the sizes where it matters.
+ */
+#define FIB_BATCH_STEP 64
+
+typedef struct {
+    uint64_t n;
+    size_t i;
+} fib_index;
+
+static int fib_index_cmp(const void *a, const void *b)
+{
+    const uint64_t x = ((const fib_index *) a)->n;
+    const uint64_t y = ((const fib_index *) b)->n;
+    return (x > y) - (x < y);
+}
+
+/* The indices are taken in increasing order. The ladder of fast doubling
+ * for n passes through (F_{n >> i}, F_{(n >> i) - 1}) at every depth i, and
+ * all of these are kept, so that the ladder of the next index starts from
+ * the deepest state it shares with the last one, which is at the highest bit
+ * where the two differ. Between close indices, F_{m+1} = F_m + F_{m-1}
+ * steps the pair of the last index forward instead.
+ */
+void fib_batch(const uint64_t *ns, size_t count, bn *fibs)
+{
+    if (!count)
+        return;
+    ASSERT(ns != NULL);
+    ASSERT(fibs != NULL);
+
+    fib_index *order = MALLOC(count * sizeof(*order));
+    for (size_t i = 0; i < count; i++)
+        order[i] = (fib_index){ns[i], i};
+    qsort(order, count, sizeof(*order), fib_index_cmp);
+
+    /* path[i] = (F_k, F_{k-1}) for k = last >> i, the ladder of the last
+     * index it ran for, up to depth top. path[0] is stepped onwards to the
+     * current index m, which the ladder does not need any more. */
+    struct {
+        bn_t f1, f0;
+    } path[64];
+    for (int i = 0; i < 64; i++) {
+        bn_init(path[i].f1);
+        bn_init(path[i].f0);
+    }
+    bn_t s, t;
+    bn_init(s);
+    bn_init(t);
+    uint64_t last = 0, m = 0;
+    int top = -1;
+
+    for (size_t j = 0; j < count; j++) {
+        const uint64_t n = order[j].n;
+        bn *const fib = &fibs[order[j].i];
+        if (n == 0) {
+            bn_zero(fib);
+            continue;
+        }
+
+        if (top < 0 || n - m > FIB_BATCH_STEP) {
+            /* Resume the ladder below the highest differing bit, or start
+             * it over at F_1 for an index of another length. */
+            const int bits = 63 - __builtin_clzll(n);
+            int depth = top == bits ? 64 - __builtin_clzll(last ^ n) : bits;
+            if (depth == bits) {
+                bn_set_u32(path[bits].f1, 1);
+                bn_zero(path[bits].f0);
+            }
+            const apm_size size = fib_digits(n);
+            bn_reserve(s, size);
+            bn_reserve(t, size);
+            for (; depth > 0; depth--) {
+                const uint64_t k = n >> (depth - 1);
+                bn_reserve(path[depth - 1].f1, fib_digits(k));
+                bn_reserve(path[depth - 1].f0, fib_digits(k));
+                fib_double(path[depth].f1, path[depth].f0, (k >> 1) & 1,
+                           k & 1, path[depth - 1].f1, path[depth - 1].f0, s,
+                           t);
+            }
+            top = bits;
+            last = m = n;
+        }
+        for (; m < n; m++) {
+            bn_add(path[0].f1, path[0].f0, path[0].f0);
+            bn_swap(path[0].f1, path[0].f0);
+        }
+        bn_set(fib, path[0].f1);
+    }
+
+    for (int i = 0; i < 64; i++) {
+        bn_free(path[i].f1);
+        bn_free(path[i].f0);
+    }
+    bn_free(s);
+    bn_free(t);
+    FREE(order);
+}
+
+const fib_engine fib_engines[] = {
+    {"doubling", fib_doubling},
+    {"matrix", fib_matrix},
+    {NULL, NULL},
+};
+
+const fib_engine *fib_engine_find(const char *name)
+{
+    for (const fib_engine *e = fib_engines; e->name; e++) {
+        if (!strcmp(e->name, name))
+            return e;
+    }
+    return NULL;
+}
@@ -0,0 +1,76 @@
+/* Fibonacci number engines. */
+
+#ifndef _FIB_H_
+#define _FIB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bn.h"
+
+typedef struct {
+    const char *name;
+    /* Set FIB = F(n). */
+    void (*fn)(uint64_t n, bn *fib);
+} fib_engine;
+
+/* Set FIB = F(n) by powering the Fibonacci matrix: two squares and one
+ * product per bit of n.
+ */
+void fib_matrix(uint64_t n, bn *fib);
+
+/* Set FIB = F(n) by fast doubling: two squares per bit of n. */
+void fib_doubling(uint64_t n, bn *fib);
+
+/* Set FIB = F(n) by fast doubling, like fib_doubling, saving the state of
+ * the ladder to the file PATH every INTERVAL seconds and at the end, and
+ * starting from the state in PATH if it is one of the ladder of n. So a
+ * computation which was stopped resumes where it was last saved, and one
+ * without a PATH to read starts afresh. Returns 0, or -1 if a state could
+ * not be saved; FIB is right either way. Returns -2, computing nothing, if
+ * PATH holds anything else, such as the state of another n.
+ */
+int fib_doubling_resumable(uint64_t n,
+                           bn *fib,
+                           const char *path,
+                           unsigned int interval);
+
+/* Step (F1, F0) = (F_k, F_{k-1}) for k = n >> FROM down the fast doubling
+ * ladder of n, to k = n >> TO. F(n) is at the end of the ladder from
+ * (F_1, F_0) at FROM = floor(log2(n)) to TO = 0.
+ */
+void fib_ladder(uint64_t n,
+                unsigned int from,
+                unsigned int to,
+                bn *f1,
+                bn *f0);
+
+/* Set FIBS[i] = F(NS[i]) for the COUNT indices of NS, which may come in any
+ * order and repeat. Sharing the work between the indices, this is much faster
+ * than computing them one at a time when they are many or close together.
+ */
+void fib_batch(const uint64_t *ns, size_t count, bn *fibs);
+
+/* A persistent cache of fast doubling states (F_k, F_{k-1}), in a file which
+ * fills in as indices are computed through it and may be shared by processes.
+ */
+typedef struct fib_cache fib_cache;
+
+/* Open the cache file PATH, creating it if needed. Returns NULL if it cannot
+ * be opened, or was written by a host of another byte order or digit size.
+ */
+fib_cache *fib_cache_open(const char *path);
+void fib_cache_close(fib_cache *c);
+
+/* Set FIB = F(n), starting from the cached state nearest to n, and keep the
+ * states of its ladder which later indices are likely to start from.
+ */
+void fib_cache_fib(fib_cache *c, uint64_t n, bn *fib);
+
+/* The engines, the default one first, up to an entry with a NULL name. */
+extern const fib_engine fib_engines[];
+
+/* Return the engine named NAME, or NULL. */
+const fib_engine *fib_engine_find(const char *name);
+
+#endif /* !_FIB_H_ */
@@ -0,0 +1,331 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fib.h"
+
+/* The cache file is a header, then records appended in any order:
+ *
+ *   k, size1, size0        three uint64_t
+ *   F_k                    size1 digits
+ *   F_{k-1}                size0 digits
+ *   (padding to 8 bytes)
+ *   tag                    uint64_t, RECORD_TAG of k, size1 and size0
+ *
+ * Everything is in the byte order and the digit size of the host which wrote
+ * it; the header tells them, and a file of another kind is refused rather
+ * than converted. Records are only ever appended, under an exclusive lock of
+ * the file, so that processes may share a cache. The tag is written last: the
+ * records end at the first one cut short by a crash, or without its tag, and
+ * the next append truncates the file there first. Removing the file at any
+ * time is safe.
+ */
+
+#define FIB_CACHE_MAGIC "FIBCACHE"
+#define FIB_CACHE_VERSION 2
+#define FIB_CACHE_ORDER 0x01020304U
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;      /* FIB_CACHE_ORDER, as written by the host. */
+    uint32_t digit_size; /* APM_DIGIT_SIZE */
+    uint32_t unused;
+} fib_cache_header;
+
+typedef struct {
+    uint64_t k;
+    uint64_t size1, size0;
+} fib_cache_record;
+
+#define RECORD_DIGITS_END(r)                                               \
+    ((sizeof(fib_cache_record) + ((r)->size1 + (r)->size0) * APM_DIGIT_SIZE + \
+      7) &                                                                 \
+     ~(size_t) 7)
+#define RECORD_BYTES(r) (RECORD_DIGITS_END(r) + sizeof(uint64_t))
+
+/* Any mix of the fields which a run of zeroes or of other bytes is unlikely
+ * to match.
+ */
+#define RECORD_TAG(r)                                             \
+    (((r)->k * UINT64_C(0x9e3779b97f4a7c15)) ^                    \
+     ((r)->size1 * UINT64_C(0xc2b2ae3d27d4eb4f)) ^                \
+     ((r)->size0 * UINT64_C(0x165667b19e3779f9)) ^ UINT64_C(0x46494243))
+
+/* Indices below this are computed faster than they are read back. */
+#define FIB_CACHE_MIN (UINT64_C(1) << 14)
+
+/* Largest gap from a cached index to n which is crossed with additions, as
+ * in fib_batch.
+ */
+#define FIB_CACHE_STEP 64
+
+struct fib_cache {
+    int fd;
+    const char *map; /* The file, read-only. */
+    size_t length;
+};
+
+/* Map the file as it is now, which other processes may have extended. */
+static int fib_cache_remap(fib_cache *c)
+{
+    struct stat st;
+    if (fstat(c->fd, &st) != 0)
+        return -1;
+    if ((size_t) st.st_size == c->length)
+        return 0;
+
+    if (c->map)
+        munmap((void *) c->map, c->length);
+    c->map = NULL;
+    c->length = 0;
+    if (st.st_size == 0)
+        return 0;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, c->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    c->map = map;
+    c->length = st.st_size;
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t off)
+{
+    while (len) {
+        const ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0)
+            return -1;
+        buf = (const char *) buf + n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+fib_cache *fib_cache_open(const char *path)
+{
+    fib_cache *c = MALLOC(sizeof(*c));
+    c->map = NULL;
+    c->length = 0;
+    c->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (c->fd < 0) {
+        FREE(c);
+        return NULL;
+    }
+
+    const fib_cache_header header = {
+        FIB_CACHE_MAGIC, FIB_CACHE_VERSION, FIB_CACHE_ORDER, APM_DIGIT_SIZE, 0,
+    };
+    int ret = 0;
+    flock(c->fd, LOCK_EX);
+    if (fib_cache_remap(c) != 0)
+        ret = -1;
+    else if (c->length == 0)
+        ret = write_all(c->fd, &header, sizeof(header), 0);
+    else if (c->length < sizeof(header) ||
+             memcmp(c->map, &header, sizeof(header)) != 0)
+        ret = -1;
+    flock(c->fd, LOCK_UN);
+
+    if (ret != 0) {
+        fib_cache_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+void fib_cache_close(fib_cache *c)
+{
+    if (!c)
+        return;
+    if (c->map)
+        munmap((void *) c->map, c->length);
+    close(c->fd);
+    FREE(c);
+}
+
+/* Call FN on every whole record of the mapping, until it returns true. If
+ * END is not NULL, it is set to the end of the records scanned.
+ */
+static const fib_cache_record *fib_cache_scan(
+    const fib_cache *c,
+    bool (*fn)(const fib_cache_record *r, void *arg),
+    void *arg,
+    size_t *end)
+{
+    const fib_cache_record *found = NULL;
+    size_t off = sizeof(fib_cache_header);
+    while (off + sizeof(fib_cache_record) <= c->length) {
+        const fib_cache_record *r = (const void *) (c->map + off);
+        const size_t left = c->length - off;
+        if (r->size1 > left || r->size0 > left || RECORD_BYTES(r) > left)
+            break;
+        uint64_t tag;
+        memcpy(&tag, c->map + off + RECORD_DIGITS_END(r), sizeof(tag));
+        if (tag != RECORD_TAG(r))
+            break;
+        off += RECORD_BYTES(r);
+        if (fn(r, arg)) {
+            found = r;
+            break;
+        }
+    }
+    if (end)
+        *end = off;
+    return found;
+}
+
+static bool record_is(const fib_cache_record *r, void *arg)
+{
+    return r->k == *(const uint64_t *) arg;
+}
+
+/* The state to start F_n from. */
+typedef struct {
+    uint64_t n;
+    const fib_cache_record *best;
+    unsigned int depth; /* On the ladder of n, or 0 for additions. */
+    uint64_t steps;     /* Additions from k to n. */
+} fib_cache_find;
+
+/* A record within FIB_CACHE_STEP below n is reached with additions, and
+ * beats a state on the ladder of n. Among states on the ladder, the last
+ * one, at the smallest depth, saves the most.
+ */
+static bool record_nearer(const fib_cache_record *r, void *arg)
+{
+    fib_cache_find *f = arg;
+    if (r->k > f->n)
+        return false;
+
+    if (f->n - r->k <= FIB_CACHE_STEP) {
+        if (!f->best || f->depth || f->n - r->k < f->steps) {
+            f->best = r;
+            f->depth = 0;
+            f->steps = f->n - r->k;
+        }
+        return f->steps == 0;
+    }
+
+    const unsigned int depth = __builtin_clzll(r->k) - __builtin_clzll(f->n);
+    if (f->n >> depth == r->k && (!f->best || depth < f->depth)) {
+        f->best = r;
+        f->depth = depth;
+    }
+    return false;
+}
+
+/* Append (F_k, F_{k-1}) = (F1, F0), unless k is there already. Returns 0,
+ * or -1 if the file could not take it.
+ */
+static int fib_cache_store(fib_cache *c,
+                           uint64_t k,
+                           const bn *f1,
+                           const bn *f0)
+{
+    const fib_cache_record r = {k, f1->size, f0->size};
+    const uint64_t tag = RECORD_TAG(&r);
+    static const char pad[8];
+
+    int ret = 0;
+    size_t whole;
+    flock(c->fd, LOCK_EX);
+    if (fib_cache_remap(c) != 0) {
+        ret = -1;
+    } else if (!fib_cache_scan(c, record_is, &k, &whole)) {
+        /* Cut off a record left torn by a crash, which would otherwise hide
+         * this one and all later ones. */
+        const off_t end = whole;
+        const size_t digits1 = f1->size * APM_DIGIT_SIZE;
+        const size_t digits0 = f0->size * APM_DIGIT_SIZE;
+        const size_t used = sizeof(r) + digits1 + digits0;
+        const size_t padded = RECORD_DIGITS_END(&r);
+        if ((whole < c->length && ftruncate(c->fd, end) != 0) ||
+            write_all(c->fd, &r, sizeof(r), end) != 0 ||
+            write_all(c->fd, f1->digits, digits1, end + sizeof(r)) != 0 ||
+            write_all(c->fd, f0->digits, digits0, end + sizeof(r) + digits1) !=
+                0 ||
+            write_all(c->fd, pad, padded - used, end + used) != 0 ||
+            write_all(c->fd, &tag, sizeof(tag), end + padded) != 0) {
+            /* Out of room: drop the partial record. Should that fail too,
+             * its missing tag keeps it out of the records until the next
+             * store cuts it off. */
+            if (ftruncate(c->fd, end) != 0)
+                fprintf(stderr, "Cannot drop a partial cache record.\n");
+            ret = -1;
+        }
+    }
+    flock(c->fd, LOCK_UN);
+    return ret;
+}
+
+static void fib_cache_load(const apm_digit *digits, uint64_t size, bn *p)
+{
+    bn_t view;
+    bn_view(view, digits, size, 0);
+    bn_set(p, view);
+}
+
+/* Depths of the ladder of n whose states are kept: n itself, which is the
+ * likeliest to be asked again or stepped from, and the states at
+ * power-of-two depths, shared by the ladders of the indices around n.
+ */
+static const unsigned int fib_cache_depths[] = {32, 16, 8, 4, 2, 1, 0};
+
+void fib_cache_fib(fib_cache *c, uint64_t n, bn *fib)
+{
+    ASSERT(c != NULL);
+
+    if (n < FIB_CACHE_MIN) {
+        fib_doubling(n, fib);
+        return;
+    }
+
+    bn *f1 = fib; /* F_k, in the output param */
+    bn_t f0;
+    bn_init(f0);
+
+    fib_cache_find f = {n, NULL, 0, 0};
+    unsigned int depth = 63 - __builtin_clzll(n);
+    bool found = false;
+    flock(c->fd, LOCK_SH);
+    if (fib_cache_remap(c) == 0)
+        fib_cache_scan(c, record_nearer, &f, NULL);
+    if (f.best) {
+        const apm_digit *digits = (const void *) (f.best + 1);
+        fib_cache_load(digits, f.best->size1, f1);
+        fib_cache_load(digits + f.best->size1, f.best->size0, f0);
+        depth = f.depth;
+        found = f.best->k == n;
+    }
+    flock(c->fd, LOCK_UN);
+
+    if (!f.best) {
+        bn_set_u32(f1, 1); /* F_1 = 1 */
+        bn_zero(f0);       /* F_0 = 0 */
+    }
+    for (; f.steps; f.steps--) {
+        bn_add(f1, f0, f0);
+        bn_swap(f1, f0);
+    }
+
+    /* Descend the rest of the ladder, keeping its states on the way. A
+     * state at depth 0 is kept unless it was found as it is. A full cache
+     * only stops the filling. */
+    for (size_t i = 0; i < sizeof(fib_cache_depths) / sizeof(*fib_cache_depths);
+         i++) {
+        const unsigned int to = fib_cache_depths[i];
+        if (to > depth || (to == depth && (to || found)))
+            continue;
+        fib_ladder(n, depth, to, f1, f0);
+        depth = to;
+        if (n >> to >= FIB_CACHE_MIN)
+            fib_cache_store(c, n >> to, f1, f0);
+    }
+
+    bn_free(f0);
+}
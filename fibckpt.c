@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fib.h"
+
+/* A checkpoint file holds one state of the fast doubling ladder of n:
+ *
+ *   header                 fib_checkpoint_header
+ *   F_k                    size1 digits
+ *   F_{k-1}                size0 digits
+ *
+ * for k = n >> depth, in the byte order and digit size of the host, which
+ * the header tells. It is written aside and renamed over the previous one,
+ * so that a crash at any time leaves a whole checkpoint behind.
+ */
+
+#define FIB_CHECKPOINT_MAGIC "FIBCKPT"
+#define FIB_CHECKPOINT_VERSION 1
+#define FIB_CHECKPOINT_ORDER 0x01020304U
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;      /* FIB_CHECKPOINT_ORDER, as written by the host. */
+    uint32_t digit_size; /* APM_DIGIT_SIZE */
+    uint32_t depth;
+    uint64_t n;
+    uint64_t size1, size0;
+} fib_checkpoint_header;
+
+static int fib_checkpoint_save(const char *path,
+                               uint64_t n,
+                               unsigned int depth,
+                               const bn *f1,
+                               const bn *f0)
+{
+    const fib_checkpoint_header h = {
+        FIB_CHECKPOINT_MAGIC, FIB_CHECKPOINT_VERSION, FIB_CHECKPOINT_ORDER,
+        APM_DIGIT_SIZE,       depth,                  n,
+        f1->size,             f0->size,
+    };
+
+    const size_t len = strlen(path);
+    char *tmp = MALLOC(len + sizeof(".tmp"));
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+    int ret = -1;
+    FILE *fp = fopen(tmp, "wb");
+    if (fp) {
+        if (fwrite(&h, sizeof(h), 1, fp) == 1 &&
+            fwrite(f1->digits, APM_DIGIT_SIZE, f1->size, fp) == f1->size &&
+            fwrite(f0->digits, APM_DIGIT_SIZE, f0->size, fp) == f0->size &&
+            fflush(fp) == 0 && fsync(fileno(fp)) == 0)
+            ret = 0;
+        if (fclose(fp) != 0)
+            ret = -1;
+        if (ret == 0)
+            ret = rename(tmp, path);
+        if (ret != 0)
+            remove(tmp);
+    }
+    FREE(tmp);
+    return ret;
+}
+
+/* Read the digits of P, SIZE of them, from FP. */
+static int fib_checkpoint_read(FILE *fp, uint64_t size, bn *p)
+{
+    bn_reserve(p, size);
+    if (fread(p->digits, APM_DIGIT_SIZE, size, fp) != size)
+        return -1;
+    p->size = size;
+    p->sign = 0;
+    return 0;
+}
+
+/* Load the state saved in PATH. Returns its depth, -1 if PATH cannot be
+ * read, e.g. as it does not exist yet, or -2 if it holds anything but a
+ * state of the ladder of n, which is then left alone.
+ */
+static int fib_checkpoint_load(const char *path, uint64_t n, bn *f1, bn *f0)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+
+    const apm_size max_size = ~(apm_size) 0;
+    fib_checkpoint_header h;
+    int ret = -2;
+    if (fread(&h, sizeof(h), 1, fp) == 1 &&
+        !memcmp(h.magic, FIB_CHECKPOINT_MAGIC, sizeof(h.magic)) &&
+        h.version == FIB_CHECKPOINT_VERSION &&
+        h.order == FIB_CHECKPOINT_ORDER && h.digit_size == APM_DIGIT_SIZE &&
+        h.n == n && h.depth <= 63U - __builtin_clzll(n) &&
+        h.size1 <= max_size && h.size0 <= max_size &&
+        fib_checkpoint_read(fp, h.size1, f1) == 0 &&
+        fib_checkpoint_read(fp, h.size0, f0) == 0 && fgetc(fp) == EOF)
+        ret = h.depth;
+    fclose(fp);
+    return ret;
+}
+
+int fib_doubling_resumable(uint64_t n,
+                           bn *fib,
+                           const char *path,
+                           unsigned int interval)
+{
+    ASSERT(path != NULL);
+
+    bn *f1 = fib; /* F_k, in the output param */
+    bn_t f0;
+    bn_init(f0);
+
+    /* Another run may own the file: overwriting it would lose its work. */
+    int depth = fib_checkpoint_load(path, n, f1, f0);
+    if (depth == -2) {
+        bn_free(f0);
+        return -2;
+    }
+    if (unlikely(n <= 2)) {
+        bn_free(f0);
+        fib_doubling(n, fib);
+        return 0;
+    }
+    if (depth < 0) {
+        bn_set_u32(f1, 1); /* F_1 = 1 */
+        bn_zero(f0);       /* F_0 = 0 */
+        depth = 63 - __builtin_clzll(n);
+    }
+
+    /* A step at the top of the ladder is short, and one at the bottom may
+     * take hours, so the checkpoints follow the clock and not the steps. */
+    int ret = 0;
+    time_t last = time(NULL);
+    while (depth > 0) {
+        fib_ladder(n, depth, depth - 1, f1, f0);
+        --depth;
+        if (depth == 0 || time(NULL) - last >= (time_t) interval) {
+            if (fib_checkpoint_save(path, n, depth, f1, f0) != 0)
+                ret = -1;
+            last = time(NULL);
+        }
+    }
+    /* Now f1 (alias of output parameter fib) = F[n] */
+
+    bn_free(f0);
+    return ret;
+}
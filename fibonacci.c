@@ -1,74 +1,210 @@
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-#include "bn.h"
+#include "fib.h"
 
-/* Compute the Nth Fibonnaci number F_n, where
- * F_0 = 0
- * F_1 = 1
- * F_n = F_{n-1} + F_{n-2} for n >= 2.
- *
- * This is based on the matrix identity:
- *        n
- * [ 0 1 ]  = [ F_{n-1}    F_n   ]
- * [ 1 1 ]    [   F_n    F_{n+1} ]
- *
- * Exponentiation uses binary power algorithm from high bit to low bit.
- */
-static void fibonacci(uint64_t n, bn *fib)
+static void usage(const char *prog)
 {
-    if (unlikely(n <= 2)) {
-        if (n == 0)
-            bn_zero(fib);
-        else
-            bn_set_u32(fib, 1);
-        return;
-    }
-
-    bn *a1 = fib; /* Use output param fib as a1 */
+    fprintf(stderr,
+            "Usage: %s [-c cache] [-e engine] [-j threads] [-q] [-b | n...]\n"
+            "       %s -r checkpoint [-i seconds] [-j threads] [-q] n\n",
+            prog, prog);
+    fprintf(stderr,
+            "  -b         read the indices from standard input\n"
+            "  -c cache   start from and add to the ladder states kept in the\n"
+            "             file CACHE\n"
+            "  -e engine  compute with ENGINE:");
+    for (const fib_engine *e = fib_engines; e->name; e++)
+        fprintf(stderr, " %s%s", e->name, e == fib_engines ? " (default)" : "");
+    fprintf(stderr,
+            "\n             several indices are computed together, unless an\n"
+            "             engine or a cache is given\n"
+            "  -i seconds save a checkpoint every SECONDS, 600 by default\n"
+            "  -j threads run on THREADS threads, 0 for one per CPU\n"
+            "  -q         compute only, print nothing\n"
+            "  -r file    save checkpoints to FILE and resume from the one it\n"
+            "             holds, which must be of n; it is removed once F(n)\n"
+            "             is out\n");
+}
 
-    bn_t a0, tmp, a;
-    bn_init_u32(a0, 0); /*  a0 = 0 */
-    bn_set_u32(a1, 1);  /*  a1 = 1 */
-    bn_init(tmp);       /* tmp = 0 */
-    bn_init(a);
+/* Set *N to the decimal number S, which MUST be all digits and at most MAX.
+ * Returns 0, or -1 with *N unchanged.
+ */
+static int parse_u64(const char *s, uint64_t max, uint64_t *n)
+{
+    if (!isdigit((unsigned char) *s))
+        return -1;
+    char *end;
+    errno = 0;
+    const unsigned long long v = strtoull(s, &end, 10);
+    if (*end || errno == ERANGE || v > max)
+        return -1;
+    *n = v;
+    return 0;
+}
 
-    /* Start at second-highest bit set. */
-    for (uint64_t k = ((uint64_t) 1) << (62 - __builtin_clzll(n)); k; k >>= 1) {
-        /* Both ways use two squares, two adds, one multipy and one shift. */
-        bn_lshift(a0, 1, a); /* a03 = a0 * 2 */
-        bn_add(a, a1, a);    /*   ... + a1 */
-        bn_sqr(a1, tmp);     /* tmp = a1^2 */
-        bn_sqr(a0, a0);      /* a0 = a0 * a0 */
-        bn_add(a0, tmp, a0); /*  ... + a1 * a1 */
-        bn_mul(a1, a, a1);   /*  a1 = a1 * a */
-        if (k & n) {
-            bn_swap(a1, a0);    /*  a1 <-> a0 */
-            bn_add(a0, a1, a1); /*  a1 += a0 */
+/* Append the indices read from FP to *NS, which holds *COUNT of them.
+ * Returns 0, or -1 on a malformed index.
+ */
+static int read_indices(FILE *fp, uint64_t **ns, size_t *count)
+{
+    size_t alloc = *count;
+    char word[32];
+    while (fscanf(fp, "%31s", word) == 1) {
+        uint64_t n;
+        if (parse_u64(word, UINT64_MAX, &n) != 0)
+            return -1;
+        if (*count == alloc) {
+            alloc = alloc ? 2 * alloc : 1024;
+            *ns = realloc(*ns, alloc * sizeof(**ns));
+            if (!*ns)
+                abort();
         }
+        (*ns)[(*count)++] = n;
     }
-    /* Now a1 (alias of output parameter fib) = F[n] */
-
-    bn_free(a0);
-    bn_free(tmp);
-    bn_free(a);
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    bn_t fib = BN_INITIALIZER;
+    const fib_engine *engine = NULL;
+    fib_cache *cache = NULL;
+    const char *checkpoint = NULL;
+    unsigned int interval = 600;
+    int batch = 0, quiet = 0, opt;
+    uint64_t value;
 
-    if (argc < 2)
+    while ((opt = getopt(argc, argv, "bc:e:i:j:qr:")) != -1) {
+        switch (opt) {
+        case 'b':
+            batch = 1;
+            break;
+        case 'c':
+            fib_cache_close(cache);
+            cache = fib_cache_open(optarg);
+            if (!cache) {
+                fprintf(stderr, "Cannot use %s as a cache.\n", optarg);
+                return -1;
+            }
+            break;
+        case 'e':
+            engine = fib_engine_find(optarg);
+            if (!engine) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'i':
+            if (parse_u64(optarg, UINT_MAX, &value) != 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            interval = value;
+            break;
+        case 'j':
+            if (parse_u64(optarg, UINT_MAX, &value) != 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            if (apm_set_threads(value) != 0) {
+                fprintf(stderr, "Cannot start %s threads.\n", optarg);
+                return -1;
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'r':
+            checkpoint = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (batch ? optind != argc : optind == argc) {
+        usage(argv[0]);
+        return -1;
+    }
+    /* Only the fast doubling ladder of a single index is checkpointed. */
+    if (checkpoint && (batch || cache || engine || optind != argc - 1)) {
+        usage(argv[0]);
         return -1;
+    }
 
-    unsigned int n = strtoul(argv[1], NULL, 10);
-    if (!n)
-        return -2;
+    uint64_t *ns = NULL;
+    size_t count = 0;
+    if (batch) {
+        if (read_indices(stdin, &ns, &count) != 0) {
+            free(ns);
+            return -2;
+        }
+    } else {
+        count = argc - optind;
+        ns = malloc(count * sizeof(*ns));
+        if (!ns)
+            abort();
+        for (size_t i = 0; i < count; i++) {
+            if (parse_u64(argv[optind + i], UINT64_MAX, &ns[i]) != 0) {
+                free(ns);
+                usage(argv[0]);
+                return -1;
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!ns[i]) {
+            free(ns);
+            return -2;
+        }
+    }
 
-    fibonacci(n, fib);
-    printf("Fib(%u)=", n), bn_print_dec(fib), printf("\n");
+    bn *fibs = malloc(count * sizeof(*fibs));
+    if (count && !fibs)
+        abort();
+    for (size_t i = 0; i < count; i++)
+        bn_init(&fibs[i]);
+    if (checkpoint) {
+        const int ret =
+            fib_doubling_resumable(ns[0], &fibs[0], checkpoint, interval);
+        if (ret == -2) {
+            fprintf(stderr, "%s is no checkpoint of Fib(%" PRIu64 ").\n",
+                    checkpoint, ns[0]);
+            bn_free(&fibs[0]);
+            free(fibs);
+            free(ns);
+            return -2;
+        }
+        if (ret != 0)
+            fprintf(stderr, "Cannot save a checkpoint to %s.\n", checkpoint);
+    } else if (cache) {
+        for (size_t i = 0; i < count; i++)
+            fib_cache_fib(cache, ns[i], &fibs[i]);
+    } else if (engine || count == 1) {
+        if (!engine)
+            engine = fib_engines;
+        for (size_t i = 0; i < count; i++)
+            engine->fn(ns[i], &fibs[i]);
+    } else {
+        fib_batch(ns, count, fibs);
+    }
 
-    bn_free(fib);
+    for (size_t i = 0; i < count; i++) {
+        if (!quiet)
+            printf("Fib(%" PRIu64 ")=", ns[i]), bn_print_dec(&fibs[i]),
+                printf("\n");
+        bn_free(&fibs[i]);
+    }
+    free(fibs);
+    free(ns);
+    fib_cache_close(cache);
+    if (checkpoint)
+        remove(checkpoint);
 
     return 0;
 }
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "apm.h"
@@ -137,11 +138,19 @@ static size_t apm_string_size(apm_size size, unsigned int radix)
     ASSERT(radix <= 36);
 
     if ((radix & (radix - 1)) == 0) {
-        unsigned int lg = apm_digit_lsb_shift(radix);
-        return ((size * APM_DIGIT_BITS + lg - 1) / lg) + 1;
+        /* Bases 8 and 32 take the bits of whole characters which fit in one
+         * digit at a time. */
+        const unsigned int lg = apm_digit_lsb_shift(radix);
+        const unsigned int shift = lg * (APM_DIGIT_BITS / lg);
+        return (((size_t) size * APM_DIGIT_BITS + shift - 1) / shift) *
+                   (shift / lg) +
+               1;
     }
-    /* round up to second next largest integer */
-    return (size_t)(radix_sizes[radix] * (size * APM_DIGIT_SIZE)) + 2;
+    /* round up to second next largest integer, past the rounding error of
+     * the table, which would show at millions of characters */
+    return (size_t) (radix_sizes[radix] * ((double) size * APM_DIGIT_SIZE) *
+                     (1 + 1e-7)) +
+           2;
 }
 
 /* Set u[size] = u[usize] / v, and return the remainder. */
@@ -177,124 +186,557 @@ static apm_digit apm_ddivi(apm_digit *u, apm_size size, apm_digit v)
     return s1;
 }
 
+/* Set v[n + 1] = floor(B^(2n) / d[n]), where the top bit of d is set, by
+ * Newton's iteration. A reciprocal of the top half of D, shifted in place,
+ * is within a few B^(n-h) of the result, and one step
+ *   V' = V + V (B^(2n) - V D) / B^(2n)
+ * squares the relative error, which leaves V' a few units away. Those are
+ * stepped off against the exact remainder.
+ */
+static void apm_recip(const apm_digit *d, apm_size n, apm_digit *v)
+{
+    const apm_digit one = 1;
+
+    if (n == 1) {
+        /* B^2 / d = B + (B - d) B / d, and B - d < d unless d = B / 2. */
+        const apm_digit half = (apm_digit) 1 << (APM_DIGIT_BITS - 1);
+        if (d[0] == half) {
+            v[0] = 0;
+            v[1] = 2;
+        } else {
+            apm_digit r;
+            digit_div(-d[0], 0, d[0], v[0], r);
+            (void) r;
+            v[1] = 1;
+        }
+        return;
+    }
+
+    const apm_size h = (n + 1) / 2, l = n - h;
+    apm_recip(d + l, h, v + l);
+    apm_zero(v, l);
+
+    /* E = B^(n+h) - Vh D, with V = Vh B^l; then V += Vh E / B^(2h). */
+    apm_digit *t = APM_TMP_ALLOC((n + h + 1) + (n + 2 * h + 2));
+    apm_digit *p = t + (n + h + 1);
+    apm_mul(v + l, h + 1, d, n, t);
+    const bool below = t[n + h] == 0;
+    if (below) { /* t = B^(n+h) - t */
+        apm_size i = 0;
+        while (i < n + h && t[i] == 0)
+            ++i;
+        if (i < n + h) {
+            t[i] = -t[i];
+            while (++i < n + h)
+                t[i] = ~t[i];
+        }
+    } else { /* t = t - B^(n+h) */
+        --t[n + h];
+    }
+    apm_mul(v + l, h + 1, t, n + h + 1, p);
+    if (below)
+        apm_addi(v, n + 1, p + 2 * h, n + 1);
+    else
+        apm_subi(v, n + 1, p + 2 * h, n + 1);
+
+    /* Now step V to the exact quotient: 0 <= B^(2n) - V D < D. */
+    apm_mul(v, n + 1, d, n, p);
+    for (;;) {
+        const bool over = p[2 * n] > 1 ||
+                          (p[2 * n] == 1 && apm_rsize(p, 2 * n) != 0);
+        if (!over)
+            break;
+        apm_subi(v, n + 1, &one, 1);
+        apm_subi(p, 2 * n + 1, d, n);
+    }
+    if (p[2 * n] == 0 && apm_rsize(p, 2 * n) != 0) {
+        /* p = B^(2n) - p, the remainder. */
+        apm_size i = 0;
+        while (p[i] == 0)
+            ++i;
+        p[i] = -p[i];
+        while (++i < 2 * n)
+            p[i] = ~p[i];
+        while (apm_cmp(p, 2 * n, d, n) >= 0) {
+            apm_daddi(v, n + 1, 1);
+            apm_subi(p, 2 * n, d, n);
+        }
+    }
+    APM_TMP_FREE(t);
+}
+
+/* Set q[n] = u[usize] / d[n] and u[n] to the remainder, where the top bit of
+ * d is set, v[n + 1] is its reciprocal from apm_recip, and u < d B^n. The
+ * quotient of the top digits of U by Barrett's method is at most two short.
+ */
+static void apm_divrem_recip(apm_digit *u,
+                             apm_size usize,
+                             const apm_digit *d,
+                             const apm_digit *v,
+                             apm_size n,
+                             apm_digit *q)
+{
+    ASSERT(usize <= 2 * n);
+
+    apm_zero(q, n);
+    if (usize < n)
+        return;
+
+    const apm_size hsize = usize - (n - 1);
+    apm_digit *t = APM_TMP_ALLOC(hsize + n + 1);
+    apm_mul(u + (n - 1), hsize, v, n + 1, t);
+    apm_copy(t + n + 1, hsize <= n ? hsize : n, q);
+
+    apm_digit *qd = APM_TMP_ALLOC(2 * n);
+    apm_mul(q, n, d, n, qd);
+    const apm_size qdsize = apm_rsize(qd, 2 * n);
+    if (qdsize)
+        ASSERT(apm_subi(u, usize, qd, qdsize) == 0);
+    APM_TMP_FREE(qd);
+    APM_TMP_FREE(t);
+
+    while (apm_cmp(u, usize, d, n) >= 0) {
+        apm_subi(u, usize, d, n);
+        apm_daddi(q, n, 1);
+    }
+}
+
 static const char radix_chars[37] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
-/* Return u[size] as a null-terminated character string in a radix on [2,36]. */
-static char *apm_get_str(const apm_digit *u,
-                         apm_size size,
-                         unsigned int radix,
-                         char *out)
+/* Below this size, in digits, numbers are converted by repeated division by
+ * one digit, which takes quadratic time.
+ */
+#define GET_STR_DC_THRESHOLD 32
+
+/* Characters are gathered in chunks of this size before they are written, or
+ * of the size of the whole number if that is less. Chunks up to
+ * APM_WRITE_STACK characters are kept on the stack.
+ */
+#define APM_WRITE_CHUNK 65536
+#define APM_WRITE_STACK 256
+
+/* The destination of a conversion. Characters come in order, most
+ * significant first, and the leading zeroes of a number converted at a
+ * width which may be too large are dropped.
+ */
+typedef struct {
+    apm_write_fn write;
+    void *ud;
+    char *buf; /* A chunk of CAP characters. */
+    size_t cap;
+    size_t len;
+    bool lead; /* Nothing but zeroes so far. */
+    int ret;   /* What WRITE failed with, or 0. */
+} apm_sink;
+
+static void apm_sink_flush(apm_sink *sink)
+{
+    if (sink->len && !sink->ret)
+        sink->ret = sink->write(sink->buf, sink->len, sink->ud);
+    sink->len = 0;
+}
+
+/* Append the N characters at P, or N zeroes if P is NULL. */
+static void apm_sink_put(apm_sink *sink, const char *p, size_t n)
+{
+    if (sink->lead) {
+        if (!p)
+            return;
+        while (n && *p == '0') {
+            ++p;
+            --n;
+        }
+        if (!n)
+            return;
+        sink->lead = false;
+    }
+    while (n) {
+        size_t m = sink->cap - sink->len;
+        if (m > n)
+            m = n;
+        if (p) {
+            memcpy(sink->buf + sink->len, p, m);
+            p += m;
+        } else {
+            memset(sink->buf + sink->len, '0', m);
+        }
+        sink->len += m;
+        n -= m;
+        if (sink->len == sink->cap)
+            apm_sink_flush(sink);
+    }
+}
+
+/* Write u[size] in a power-of-two radix, LG bits per character from the top
+ * down.
+ */
+static void apm_get_str_pow2(const apm_digit *u,
+                             apm_size size,
+                             unsigned int radix,
+                             apm_sink *sink)
+{
+    const unsigned int lg = apm_digit_lsb_shift(radix);
+    const apm_digit mask = radix - 1;
+    char buf[256];
+    size_t len = 0;
+
+    size_t pos = ((size_t) size * APM_DIGIT_BITS + lg - 1) / lg * lg;
+    while (pos) {
+        pos -= lg;
+        const size_t i = pos / APM_DIGIT_BITS;
+        const unsigned int shift = pos % APM_DIGIT_BITS;
+        apm_digit r = u[i] >> shift;
+        /* Bases 8 and 32 have characters across two digits. */
+        if (shift + lg > APM_DIGIT_BITS && i + 1 < size)
+            r |= u[i + 1] << (APM_DIGIT_BITS - shift);
+        buf[len++] = radix_chars[r & mask];
+        if (len == sizeof(buf)) {
+            apm_sink_put(sink, buf, len);
+            len = 0;
+        }
+    }
+    apm_sink_put(sink, buf, len);
+}
+
+/* Write u[size] at WIDTH characters in a radix which is not a power of two,
+ * with leading zeroes, where u < radix^width and SIZE is below
+ * GET_STR_DC_THRESHOLD. U is destroyed.
+ */
+static void apm_get_str_fixed(apm_digit *u,
+                              apm_size size,
+                              unsigned int radix,
+                              size_t width,
+                              apm_sink *sink)
+{
+    const apm_digit max_radix = radix_table[radix].max_radix;
+    const unsigned int max_power = radix_table[radix].max_power;
+
+    /* Fewer characters than bits, in a radix above 2. */
+    char buf[GET_STR_DC_THRESHOLD * APM_DIGIT_BITS];
+    char *const end = buf + sizeof(buf);
+    char *p = end;
+    APM_NORMALIZE(u, size);
+    ASSERT(size < GET_STR_DC_THRESHOLD);
+    while (size != 0) {
+        /* Multi-precision: divide U by largest power of RADIX to fit in
+         * one apm_digit and extract remainder.
+         */
+        apm_digit r = apm_ddivi(u, size, max_radix);
+        size -= (u[size - 1] == 0);
+        /* Single-precision: extract K remainders from that remainder,
+         * where K is the largest integer such that RADIX^K < 2^BITS.
+         */
+        for (unsigned int i = 0; i < max_power; i++) {
+            *--p = radix_chars[r % radix];
+            r /= radix;
+        }
+        ASSERT(r == 0);
+    }
+
+    /* The last remainder may have brought zeroes beyond WIDTH. */
+    size_t len = end - p;
+    if (len > width) {
+        p += len - width;
+        len = width;
+    }
+    apm_sink_put(sink, NULL, width - len);
+    apm_sink_put(sink, p, len);
+}
+
+/* radix^chars, shifted so that its top bit is set, and its reciprocal. */
+typedef struct {
+    apm_digit *d, *v;
+    apm_size n;
+    unsigned int shift;
+    size_t chars;
+} radix_power;
+
+/* Write u[size] at WIDTH characters with leading zeroes, where
+ * u < radix^width, splitting it as u = q radix^c + r, with the largest
+ * c = chars of POWERS[k] or below which is less than WIDTH: then 2c >= width,
+ * and q and r are about half as long as U. Each division is two products by
+ * a reciprocal, so the whole takes O(M(n) log n) time. U is destroyed.
+ */
+static void apm_get_str_dc(apm_digit *u,
+                           apm_size size,
+                           unsigned int radix,
+                           const radix_power *powers,
+                           int k,
+                           size_t width,
+                           apm_sink *sink)
+{
+    if (sink->ret)
+        return;
+
+    APM_NORMALIZE(u, size);
+    if (size < GET_STR_DC_THRESHOLD) {
+        apm_get_str_fixed(u, size, radix, width, sink);
+        return;
+    }
+
+    while (powers[k].chars >= width)
+        --k;
+    ASSERT(k >= 0);
+    const radix_power *pw = &powers[k];
+    const apm_size n = pw->n;
+
+    /* u < radix^(2c) <= radix^c B^n, so the shifted U fits in 2n digits. */
+    apm_digit *t = APM_TMP_ALLOC(size + 1 + n);
+    apm_digit *q = t + size + 1;
+    t[size] = apm_lshift(u, size, pw->shift, t);
+    apm_divrem_recip(t, apm_rsize(t, size + 1), pw->d, pw->v, n, q);
+    apm_rshifti(t, n, pw->shift);
+
+    apm_get_str_dc(q, n, radix, powers, k - 1, width - pw->chars, sink);
+    apm_get_str_dc(t, n, radix, powers, k - 1, pw->chars, sink);
+    APM_TMP_FREE(t);
+}
+
+/* Write u[size] at WIDTH characters in a radix which is not a power of two,
+ * where u < radix^width and SIZE is large.
+ */
+static void apm_get_str_subquadratic(const apm_digit *u,
+                                     apm_size size,
+                                     unsigned int radix,
+                                     size_t width,
+                                     apm_sink *sink)
+{
+    /* radix^(max_power 2^k), until twice the chars of the last one cover
+     * WIDTH. */
+    radix_power powers[8 * sizeof(size_t)];
+    int k = 0;
+    apm_digit *p = apm_new(1);
+    p[0] = radix_table[radix].max_radix;
+    apm_size n = 1;
+    for (;;) {
+        radix_power *pw = &powers[k];
+        pw->n = n;
+        pw->chars = (size_t) radix_table[radix].max_power << k;
+        pw->shift = __builtin_clzll(p[n - 1]) - (64 - APM_DIGIT_BITS);
+        pw->d = apm_new(n);
+        apm_lshift(p, n, pw->shift, pw->d);
+        pw->v = apm_new(n + 1);
+        apm_recip(pw->d, n, pw->v);
+        if (2 * pw->chars >= width)
+            break;
+
+        apm_digit *sq = apm_new(2 * n);
+        apm_sqr(p, n, sq);
+        apm_free(p);
+        p = sq;
+        n = apm_rsize(p, 2 * n);
+        ++k;
+    }
+    apm_free(p);
+
+    apm_digit *t = APM_TMP_COPY(u, size);
+    apm_get_str_dc(t, size, radix, powers, k, width, sink);
+    APM_TMP_FREE(t);
+
+    for (int i = 0; i <= k; i++) {
+        apm_free(powers[i].d);
+        apm_free(powers[i].v);
+    }
+}
+
+int apm_write(const apm_digit *u,
+              apm_size size,
+              unsigned int radix,
+              apm_write_fn write,
+              void *ud)
 {
     ASSERT(u != NULL);
     ASSERT(radix >= 2);
     ASSERT(radix <= 36);
 
     APM_NORMALIZE(u, size);
-    if (size == 0 || (size == 1 && u[0] < radix)) {
-        if (!out)
-            out = MALLOC(2);
-        out[0] = size ? radix_chars[u[0]] : '0';
-        out[1] = '\0';
-        return out;
+    char stack[APM_WRITE_STACK];
+    size_t cap = apm_string_size(size, radix);
+    if (cap > APM_WRITE_CHUNK)
+        cap = APM_WRITE_CHUNK;
+    apm_sink sink = {
+        write, ud, cap <= sizeof(stack) ? stack : MALLOC(cap), cap, 0, true, 0,
+    };
+    if (size == 0) {
+        sink.lead = false;
+        apm_sink_put(&sink, "0", 1);
+    } else if ((radix & (radix - 1)) == 0) {
+        apm_get_str_pow2(u, size, radix, &sink);
+    } else if (size < GET_STR_DC_THRESHOLD) {
+        apm_digit *tmp = APM_TMP_COPY(u, size);
+        apm_get_str_fixed(tmp, size, radix, apm_string_size(size, radix),
+                          &sink);
+        APM_TMP_FREE(tmp);
+    } else {
+        apm_get_str_subquadratic(u, size, radix, apm_string_size(size, radix),
+                                 &sink);
     }
+    apm_sink_flush(&sink);
+    if (sink.buf != stack)
+        FREE(sink.buf);
+    return sink.ret;
+}
 
-    const apm_digit max_radix = radix_table[radix].max_radix;
-    const unsigned int max_power = radix_table[radix].max_power;
+unsigned int apm_char_value(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (isalpha(c))
+        return toupper(c) - 'A' + 10;
+    return 36;
+}
 
-    if (!out)
-        out = MALLOC(apm_string_size(size, radix) + 1);
-    char *outp = out;
+apm_size apm_str_digits(size_t len, unsigned int radix)
+{
+    ASSERT(radix >= 2);
+    ASSERT(radix <= 36);
 
-    if ((radix & (radix - 1)) == 0) { /* Radix is a power of two. */
-        /* We need to extract LG bits for each digit. */
+    if ((radix & (radix - 1)) == 0) {
         const unsigned int lg = apm_digit_lsb_shift(radix);
-        const apm_digit mask = radix - 1; /* mask = ((apm_digit)1 << lg) - 1; */
-        const unsigned int od = APM_DIGIT_BITS / lg;
-        if (APM_DIGIT_BITS % lg == 0) { /* bases 2 (2^1), 4 (2^2), 16 (2^4) */
-            const apm_digit *ue = u + size;
-
-            do {
-                apm_digit r = *u;
-                unsigned int i = 0;
-                do {
-                    *outp++ = radix_chars[r & mask];
-                    r >>= lg;
-                } while (++i < od);
-            } while (++u < ue);
-        } else { /* bases 8 (2^3), 32 (2^5) */
-            /* Do it the lazy way */
-            const unsigned int shift = lg * od;
-
-            ASSERT(shift < APM_DIGIT_BITS);
-
-            apm_digit *tmp = APM_TMP_COPY(u, size);
-            apm_size tsize = size;
-
-            do {
-                apm_digit r = apm_rshifti(tmp, tsize, shift);
-                tsize -= (tmp[tsize - 1] == 0);
-                unsigned int i = 0;
-                do {
-                    *outp++ = radix_chars[r & mask];
-                    r >>= lg;
-                } while (++i < od);
-            } while (tsize != 0);
-
-            APM_TMP_FREE(tmp);
-        }
-    } else {
-        apm_digit *tmp = APM_TMP_COPY(u, size);
-        apm_size tsize = size;
-
-        do {
-            /* Multi-precision: divide U by largest power of RADIX to fit in
-             * one apm_digit and extract remainder.
-             */
-            apm_digit r = apm_ddivi(tmp, tsize, max_radix);
-            tsize -= (tmp[tsize - 1] == 0);
-            /* Single-precision: extract K remainders from that remainder,
-             * where K is the largest integer such that RADIX^K < 2^BITS.
-             */
-            unsigned int i = 0;
-            do {
-                apm_digit rq = r / radix;
-                apm_digit rr = r % radix;
-                *outp++ = radix_chars[rr];
-                r = rq;
-                if (tsize == 0 && r == 0) /* Eliminate any leading zeroes */
-                    break;
-            } while (++i < max_power);
-            ASSERT(r == 0);
-            /* Loop until TMP = 0. */
-        } while (tsize != 0);
+        return (len * lg + APM_DIGIT_BITS - 1) / APM_DIGIT_BITS + 1;
+    }
+    /* Every max_power characters fit in one digit, and a product of two
+     * parts may take one digit over their value. */
+    return len / radix_table[radix].max_power + 2;
+}
 
-        APM_TMP_FREE(tmp);
+/* Below this length, in digits, strings are converted by multiplying by one
+ * digit at a time, which takes quadratic time.
+ */
+#define SET_STR_DC_THRESHOLD 32
+
+/* Set u to the value of s[len] in a radix which is not a power of two, one
+ * digit's worth of characters at a time, and return its size.
+ */
+static apm_size apm_set_str_base(apm_digit *u,
+                                 const char *s,
+                                 size_t len,
+                                 unsigned int radix)
+{
+    const unsigned int max_power = radix_table[radix].max_power;
+
+    apm_size size = 0;
+    size_t m = len % max_power ? len % max_power : max_power;
+    while (len) {
+        apm_digit d = 0, scale = 1;
+        for (size_t i = 0; i < m; i++) {
+            d = d * radix + apm_char_value(s[i]);
+            scale *= radix;
+        }
+        /* u = u * radix^m + d */
+        apm_digit cy = apm_dmul(u, size, scale, u);
+        cy += apm_daddi(u, size, d);
+        if (cy)
+            u[size++] = cy;
+        s += m;
+        len -= m;
+        m = max_power;
     }
+    return size;
+}
 
-    char *f = outp - 1;
-    /* Eliminate leading (trailing) zeroes */
-    while (*f == '0')
-        --f;
-    /* NULL terminate */
-    f[1] = '\0';
-    /* Reverse digits */
-    for (char *s = out; s < f; ++s, --f)
-        SWAP(*s, *f);
-    return out;
+/* Set u to the value of s[len], splitting it as in apm_get_str_dc: the low
+ * c characters, for the largest c = chars of POWERS[k] or below which is less
+ * than LEN, and the rest, combined as hi radix^c + lo with one product.
+ * Return the size of U, which has room for apm_str_digits(len, radix) digits.
+ */
+static apm_size apm_set_str_dc(apm_digit *u,
+                               const char *s,
+                               size_t len,
+                               unsigned int radix,
+                               const radix_power *powers,
+                               int k)
+{
+    if (len < SET_STR_DC_THRESHOLD * radix_table[radix].max_power)
+        return apm_set_str_base(u, s, len, radix);
+
+    while (powers[k].chars >= len)
+        --k;
+    ASSERT(k >= 0);
+    const radix_power *pw = &powers[k];
+    const size_t hlen = len - pw->chars;
+
+    const apm_size lroom = apm_str_digits(pw->chars, radix);
+    apm_digit *lo = APM_TMP_ALLOC(lroom + apm_str_digits(hlen, radix));
+    apm_digit *hi = lo + lroom;
+    const apm_size lsize =
+        apm_set_str_dc(lo, s + hlen, pw->chars, radix, powers, k - 1);
+    const apm_size hsize = apm_set_str_dc(hi, s, hlen, radix, powers, k - 1);
+
+    apm_size size = lsize;
+    if (hsize) {
+        size = hsize + pw->n;
+        apm_mul(hi, hsize, pw->d, pw->n, u);
+        if (lsize)
+            ASSERT(apm_addi(u, size, lo, lsize) == 0);
+        size = apm_rsize(u, size);
+    } else {
+        apm_copy(lo, lsize, u);
+    }
+    APM_TMP_FREE(lo);
+    return size;
 }
 
-void apm_fprint(const apm_digit *u, apm_size size, unsigned int radix, FILE *fp)
+apm_size apm_set_str(apm_digit *u,
+                     const char *s,
+                     size_t len,
+                     unsigned int radix)
 {
     ASSERT(u != NULL);
-
     ASSERT(radix >= 2);
     ASSERT(radix <= 36);
 
-    APM_NORMALIZE(u, size);
-    const size_t string_size = apm_string_size(size, radix) + 1;
-    char *str = MALLOC(string_size);
-    char *p = apm_get_str(u, size, radix, str);
-    ASSERT(p != NULL);
-    fputs(p, fp);
-    FREE(str);
+    if ((radix & (radix - 1)) == 0) {
+        /* Pack LG bits per character, from the last one up. */
+        const unsigned int lg = apm_digit_lsb_shift(radix);
+        const apm_size size = apm_str_digits(len, radix);
+        apm_zero(u, size);
+        size_t pos = 0;
+        while (len) {
+            const apm_digit v = apm_char_value(s[--len]);
+            const size_t i = pos / APM_DIGIT_BITS;
+            const unsigned int shift = pos % APM_DIGIT_BITS;
+            u[i] |= v << shift;
+            if (shift + lg > APM_DIGIT_BITS)
+                u[i + 1] |= v >> (APM_DIGIT_BITS - shift);
+            pos += lg;
+        }
+        return apm_rsize(u, size);
+    }
+
+    const unsigned int max_power = radix_table[radix].max_power;
+    if (len < SET_STR_DC_THRESHOLD * max_power)
+        return apm_set_str_base(u, s, len, radix);
+
+    /* radix^(max_power 2^k), until twice the chars of the last one cover
+     * LEN. */
+    radix_power powers[8 * sizeof(size_t)];
+    int k = 0;
+    apm_digit *p = apm_new(1);
+    p[0] = radix_table[radix].max_radix;
+    apm_size n = 1;
+    for (;;) {
+        powers[k] = (radix_power){p, NULL, n, 0, (size_t) max_power << k};
+        if (2 * powers[k].chars >= len)
+            break;
+        p = apm_new(2 * n);
+        apm_sqr(powers[k].d, n, p);
+        n = apm_rsize(p, 2 * n);
+        ++k;
+    }
+
+    const apm_size size = apm_set_str_dc(u, s, len, radix, powers, k);
+    for (int i = 0; i <= k; i++)
+        apm_free(powers[i].d);
+    return size;
+}
+
+static int apm_fwrite(const char *s, size_t len, void *fp)
+{
+    return fwrite(s, 1, len, fp) == len ? 0 : -1;
+}
+
+void apm_fprint(const apm_digit *u, apm_size size, unsigned int radix, FILE *fp)
+{
+    apm_write(u, size, radix, apm_fwrite, fp);
 }
@@ -0,0 +1,296 @@
+#include "apm.h"
+#include "cpu.h"
+
+/* AVX-512 IFMA basecase multiplication and squaring.
+ *
+ * vpmadd52luq/vpmadd52huq add the low and high 52 bits of eight 52x52-bit
+ * products to eight 64-bit accumulators at once. The operands are therefore
+ * converted to 52-bit limbs, and the product is formed column by column
+ * ("product scanning"): for a block of consecutive columns c, the products
+ * a[i] * b[c - i] for one i read eight consecutive limbs of b, so a single
+ * broadcast of a[i] feeds a whole vector. The high halves belong one column
+ * further up. Every column receives at most 2 * min(na, nb) terms below 2^52,
+ * so the 12 spare bits of each accumulator absorb them without carries. In the
+ * end the low 52 and the high 12 bits of the columns are packed back into
+ * digits separately, and a single multi-precision addition propagates all the
+ * carries.
+ *
+ * The conversions cost about as much as a 16-digit product, below which the
+ * scalar kernels are used.
+ */
+
+#if APM_ASM_X86_64
+
+#include <immintrin.h>
+
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+#define LIMB_BITS 52
+#define LIMB_MASK ((UINT64_C(1) << LIMB_BITS) - 1)
+
+/* Columns accumulated at once, in four independent vectors. */
+#define IFMA_BLOCK 32
+
+/* Number of 52-bit limbs of an n-digit number. */
+static inline size_t ifma_limbs(apm_size n)
+{
+    return ((size_t) n * APM_DIGIT_BITS + LIMB_BITS - 1) / LIMB_BITS;
+}
+
+/* 13 digits hold exactly 16 limbs, so the conversions work on such groups.
+ * Limb k of a group starts at bit (52 k) % 64 of its digit (52 k) / 64, and
+ * digit j at bit (64 j) % 52 of its limb (64 j) / 52.
+ */
+#define GROUP_DIGITS 13
+#define GROUP_LIMBS 16
+
+#define L(k) ((52 * (k)) / 64)
+#define LB(k) ((52 * (k)) % 64)
+static const uint64_t split_idx[GROUP_LIMBS] = {
+    L(0), L(1), L(2),  L(3),  L(4),  L(5),  L(6),  L(7),
+    L(8), L(9), L(10), L(11), L(12), L(13), L(14), L(15),
+};
+static const uint64_t split_off[GROUP_LIMBS] = {
+    LB(0), LB(1), LB(2),  LB(3),  LB(4),  LB(5),  LB(6),  LB(7),
+    LB(8), LB(9), LB(10), LB(11), LB(12), LB(13), LB(14), LB(15),
+};
+#undef L
+#undef LB
+
+#define D(j) ((64 * (j)) / 52)
+#define DB(j) ((64 * (j)) % 52)
+static const uint64_t pack_idx[GROUP_LIMBS] = {
+    D(0), D(1), D(2),  D(3),  D(4),  D(5),  D(6), D(7),
+    D(8), D(9), D(10), D(11), D(12), 0,     0,    0,
+};
+static const uint64_t pack_off[GROUP_LIMBS] = {
+    DB(0), DB(1), DB(2),  DB(3),  DB(4),  DB(5),  DB(6), DB(7),
+    DB(8), DB(9), DB(10), DB(11), DB(12), 0,      0,     0,
+};
+#undef D
+#undef DB
+
+/* Mask of the first min(n, 8) lanes. */
+static inline __mmask8 ifma_mask(size_t n)
+{
+    return n >= 8 ? 0xff : (__mmask8) ((1U << n) - 1);
+}
+
+/* Convert u[size] into na 52-bit limbs at a. */
+IFMA_TARGET static void ifma_split(const apm_digit *u,
+                                   apm_size size,
+                                   apm_digit *a,
+                                   size_t na)
+{
+    const __m512i mask = _mm512_set1_epi64(LIMB_MASK);
+    const __m512i one = _mm512_set1_epi64(1), sixty4 = _mm512_set1_epi64(64);
+    for (size_t g = 0, d = 0; g < na; g += GROUP_LIMBS, d += GROUP_DIGITS) {
+        const size_t rem = size > d ? size - d : 0;
+        const __m512i w0 = _mm512_maskz_loadu_epi64(ifma_mask(rem), u + d);
+        const __m512i w1 = _mm512_maskz_loadu_epi64(
+            ifma_mask(rem > 8 ? rem - 8 : 0), u + d + 8);
+        for (size_t h = 0; h < GROUP_LIMBS && g + h < na; h += 8) {
+            const __m512i idx = _mm512_loadu_si512(split_idx + h);
+            const __m512i off = _mm512_loadu_si512(split_off + h);
+            /* The high digit of the last limb may lie past the window, but
+             * its bits are masked off then. */
+            const __m512i lo = _mm512_permutex2var_epi64(w0, idx, w1);
+            const __m512i hi = _mm512_permutex2var_epi64(
+                w0, _mm512_add_epi64(idx, one), w1);
+            const __m512i l = _mm512_or_si512(
+                _mm512_srlv_epi64(lo, off),
+                _mm512_sllv_epi64(hi, _mm512_sub_epi64(sixty4, off)));
+            _mm512_mask_storeu_epi64(a + g + h, ifma_mask(na - g - h),
+                                     _mm512_and_si512(l, mask));
+        }
+    }
+}
+
+/* Set w[wsize] = sum l[k] * 2^(52 k) over k < n, for l[k] < 2^52, where the
+ * sum MUST fit.
+ */
+IFMA_TARGET static void ifma_pack(const apm_digit *l,
+                                  size_t n,
+                                  apm_digit *w,
+                                  apm_size wsize)
+{
+    const __m512i one = _mm512_set1_epi64(1), two = _mm512_set1_epi64(2);
+    const __m512i c52 = _mm512_set1_epi64(52), c104 = _mm512_set1_epi64(104);
+    for (size_t g = 0, d = 0; d < wsize; g += GROUP_LIMBS, d += GROUP_DIGITS) {
+        const size_t rem = n > g ? n - g : 0;
+        const __m512i l0 = _mm512_maskz_loadu_epi64(ifma_mask(rem), l + g);
+        const __m512i l1 = _mm512_maskz_loadu_epi64(
+            ifma_mask(rem > 8 ? rem - 8 : 0), l + g + 8);
+        for (size_t h = 0; h < GROUP_DIGITS && d + h < wsize; h += 8) {
+            const __m512i idx = _mm512_loadu_si512(pack_idx + h);
+            const __m512i off = _mm512_loadu_si512(pack_off + h);
+            /* A digit spans up to three limbs; shifts by 64 or more give 0,
+             * which also discards the wrapped index of the last one. */
+            const __m512i x0 = _mm512_permutex2var_epi64(l0, idx, l1);
+            const __m512i x1 = _mm512_permutex2var_epi64(
+                l0, _mm512_add_epi64(idx, one), l1);
+            const __m512i x2 = _mm512_permutex2var_epi64(
+                l0, _mm512_add_epi64(idx, two), l1);
+            const __m512i x = _mm512_or_si512(
+                _mm512_or_si512(
+                    _mm512_srlv_epi64(x0, off),
+                    _mm512_sllv_epi64(x1, _mm512_sub_epi64(c52, off))),
+                _mm512_sllv_epi64(x2, _mm512_sub_epi64(c104, off)));
+            size_t left = wsize - d - h;
+            if (left > GROUP_DIGITS - h)
+                left = GROUP_DIGITS - h;
+            _mm512_mask_storeu_epi64(w + d + h, ifma_mask(left), x);
+        }
+    }
+}
+
+/* Set w[wsize] to the sum of col[c] * 2^(52 c) over c < ncol: the low 52
+ * bits and the high 12 bits of the columns are packed separately, each into
+ * disjoint bit fields, and then added. col is overwritten, and TMP holds
+ * wsize digits. HI holds ncol + 1 limbs.
+ */
+IFMA_TARGET static void ifma_join(apm_digit *col,
+                                  size_t ncol,
+                                  apm_digit *hi,
+                                  apm_digit *w,
+                                  apm_size wsize,
+                                  apm_digit *tmp)
+{
+    const __m512i mask = _mm512_set1_epi64(LIMB_MASK);
+    hi[0] = 0;
+    for (size_t c = 0; c < ncol; c += 8) {
+        const __mmask8 m = ifma_mask(ncol - c);
+        const __m512i x = _mm512_maskz_loadu_epi64(m, col + c);
+        _mm512_mask_storeu_epi64(col + c, m, _mm512_and_si512(x, mask));
+        _mm512_mask_storeu_epi64(hi + c + 1, m,
+                                 _mm512_srli_epi64(x, LIMB_BITS));
+    }
+    ifma_pack(col, ncol, w, wsize);
+    ifma_pack(hi, ncol + 1, tmp, wsize);
+    ASSERT(apm_addi_n(w, tmp, wsize) == 0);
+}
+
+/* Set col[na + nb] to the column sums of a[na] * b[nb], where b is preceded
+ * and followed by IFMA_BLOCK zero limbs, and col has room for IFMA_BLOCK
+ * further columns. The high halves are moved up one column in registers, so
+ * that every column is stored exactly once.
+ */
+IFMA_TARGET static void ifma_convolve(const apm_digit *a,
+                                      size_t na,
+                                      const apm_digit *b,
+                                      size_t nb,
+                                      apm_digit *col)
+{
+    const size_t ncol = na + nb;
+    __m512i prev = _mm512_setzero_si512(); /* high halves of the last block */
+    for (size_t c0 = 0; c0 < ncol; c0 += IFMA_BLOCK) {
+        __m512i l0 = _mm512_setzero_si512(), h0 = l0, l1 = l0, h1 = l0;
+        __m512i l2 = l0, h2 = l0, l3 = l0, h3 = l0;
+        /* Only the a[i] with c0 - nb < i < c0 + IFMA_BLOCK contribute. */
+        const size_t ilo = c0 >= nb ? c0 - nb + 1 : 0;
+        const size_t ihi = c0 + IFMA_BLOCK < na ? c0 + IFMA_BLOCK : na;
+        for (size_t i = ilo; i < ihi; i++) {
+            const __m512i x = _mm512_set1_epi64(a[i]);
+            const apm_digit *y = b + c0 - i;
+            const __m512i y0 = _mm512_loadu_si512(y);
+            const __m512i y1 = _mm512_loadu_si512(y + 8);
+            const __m512i y2 = _mm512_loadu_si512(y + 16);
+            const __m512i y3 = _mm512_loadu_si512(y + 24);
+            l0 = _mm512_madd52lo_epu64(l0, x, y0);
+            h0 = _mm512_madd52hi_epu64(h0, x, y0);
+            l1 = _mm512_madd52lo_epu64(l1, x, y1);
+            h1 = _mm512_madd52hi_epu64(h1, x, y1);
+            l2 = _mm512_madd52lo_epu64(l2, x, y2);
+            h2 = _mm512_madd52hi_epu64(h2, x, y2);
+            l3 = _mm512_madd52lo_epu64(l3, x, y3);
+            h3 = _mm512_madd52hi_epu64(h3, x, y3);
+        }
+        /* Column c receives the high halves of column c - 1. */
+        apm_digit *c = col + c0;
+        _mm512_storeu_si512(
+            c, _mm512_add_epi64(l0, _mm512_alignr_epi64(h0, prev, 7)));
+        _mm512_storeu_si512(
+            c + 8, _mm512_add_epi64(l1, _mm512_alignr_epi64(h1, h0, 7)));
+        _mm512_storeu_si512(
+            c + 16, _mm512_add_epi64(l2, _mm512_alignr_epi64(h2, h1, 7)));
+        _mm512_storeu_si512(
+            c + 24, _mm512_add_epi64(l3, _mm512_alignr_epi64(h3, h2, 7)));
+        prev = h3;
+    }
+}
+
+/* Above this many digits of the shorter operand the columns could overflow,
+ * and the subquadratic algorithms have long taken over anyway.
+ */
+#define IFMA_MAX_DIGITS 1024
+
+/* Below this many digits of the shorter operand the conversions cost more than
+ * the vector products save.
+ */
+#define IFMA_MIN_DIGITS 16
+
+/* Set w[usize + vsize] = u[usize] * v[vsize], or the square of u if V is
+ * NULL.
+ */
+static void ifma_mul(const apm_digit *u,
+                     apm_size usize,
+                     const apm_digit *v,
+                     apm_size vsize,
+                     apm_digit *w)
+{
+    const size_t na = ifma_limbs(usize);
+    const size_t nb = v ? ifma_limbs(vsize) : na;
+    const size_t ncol = na + nb;
+    const apm_size wsize = usize + vsize;
+    /* b with its zero padding, a, the columns, their high parts, and the
+     * packed high parts. */
+    const size_t bsize = nb + 2 * IFMA_BLOCK;
+    const size_t csize = ncol + IFMA_BLOCK;
+    apm_digit *b =
+        APM_TMP_ALLOC(bsize + (v ? na : 0) + csize + (ncol + 1) + wsize);
+    apm_digit *a = v ? b + bsize : b + IFMA_BLOCK;
+    apm_digit *col = b + bsize + (v ? na : 0);
+    apm_digit *hi = col + csize, *tmp = hi + ncol + 1;
+
+    apm_zero(b, IFMA_BLOCK);
+    ifma_split(v ? v : u, v ? vsize : usize, b + IFMA_BLOCK, nb);
+    apm_zero(b + IFMA_BLOCK + nb, IFMA_BLOCK);
+    if (v)
+        ifma_split(u, usize, a, na);
+
+    ifma_convolve(a, na, b + IFMA_BLOCK, nb, col);
+    ifma_join(col, ncol, hi, w, wsize, tmp);
+    APM_TMP_FREE(b);
+}
+
+void _apm_mul_base_ifma(const apm_digit *u,
+                        apm_size usize,
+                        const apm_digit *v,
+                        apm_size vsize,
+                        apm_digit *w)
+{
+    ASSERT(usize >= vsize);
+
+    const apm_size ul = apm_rsize(u, usize);
+    const apm_size vl = apm_rsize(v, vsize);
+    const apm_size minsize = ul < vl ? ul : vl;
+    if (minsize < IFMA_MIN_DIGITS || minsize > IFMA_MAX_DIGITS) {
+        _apm_mul_base_c(u, usize, v, vsize, w);
+        return;
+    }
+    apm_zero(w + ul + vl, usize + vsize - (ul + vl));
+    ifma_mul(u, ul, v, vl, w);
+}
+
+void _apm_sqr_base_ifma(const apm_digit *u, apm_size size, apm_digit *v)
+{
+    const apm_size ul = apm_rsize(u, size);
+    if (ul < IFMA_MIN_DIGITS || ul > IFMA_MAX_DIGITS) {
+        _apm_sqr_base_c(u, size, v);
+        return;
+    }
+    apm_zero(v + 2 * ul, 2 * (size - ul));
+    ifma_mul(u, ul, NULL, ul, v);
+}
+
+#endif /* APM_ASM_X86_64 */
@@ -0,0 +1,199 @@
+#include <stdalign.h>
+#include <stddef.h>
+
+#include "apm.h"
+
+static void *libc_malloc(size_t size, void *ud)
+{
+    (void) ud;
+    return malloc(size);
+}
+
+static void *libc_realloc(void *ptr, size_t size, void *ud)
+{
+    (void) ud;
+    return realloc(ptr, size);
+}
+
+static void libc_free(void *ptr, void *ud)
+{
+    (void) ud;
+    free(ptr);
+}
+
+struct _apm_allocator _apm_allocator = {libc_malloc, libc_realloc, libc_free,
+                                        NULL};
+
+void apm_set_allocator(apm_malloc_fn malloc_fn,
+                       apm_realloc_fn realloc_fn,
+                       apm_free_fn free_fn,
+                       void *ud)
+{
+    /* The workers of the pool, and its arrays, hold memory of the old hooks:
+     * the pool is stopped, which trims the arenas of the workers, and
+     * started again under the new hooks. */
+    const unsigned int threads = apm_get_threads();
+    apm_set_threads(1);
+    apm_tmp_trim();
+    _apm_allocator.malloc_fn = malloc_fn ? malloc_fn : libc_malloc;
+    _apm_allocator.realloc_fn = realloc_fn ? realloc_fn : libc_realloc;
+    _apm_allocator.free_fn = free_fn ? free_fn : libc_free;
+    _apm_allocator.ud = ud;
+    if (threads > 1 && apm_set_threads(threads) != 0)
+        fprintf(stderr, "Cannot restart %u threads.\n", threads);
+}
+
+void apm_get_allocator(apm_malloc_fn *malloc_fn,
+                       apm_realloc_fn *realloc_fn,
+                       apm_free_fn *free_fn,
+                       void **ud)
+{
+    if (malloc_fn)
+        *malloc_fn = _apm_allocator.malloc_fn;
+    if (realloc_fn)
+        *realloc_fn = _apm_allocator.realloc_fn;
+    if (free_fn)
+        *free_fn = _apm_allocator.free_fn;
+    if (ud)
+        *ud = _apm_allocator.ud;
+}
+
+/* Allocations are rounded up to this many bytes, which keeps every block at
+ * the alignment malloc would give it.
+ */
+#define TMP_ALIGN alignof(max_align_t)
+#define TMP_ROUND(n) (((n) + TMP_ALIGN - 1) & ~(size_t)(TMP_ALIGN - 1))
+
+/* Smallest chunk requested from MALLOC. */
+#define TMP_CHUNK_MIN ((size_t) 64 * 1024)
+
+typedef struct tmp_chunk {
+    struct tmp_chunk *prev; /* Chunk below this one on the stack. */
+    size_t size;            /* Usable bytes following the header. */
+    size_t used;            /* Bytes handed out. */
+    size_t high;            /* Most bytes ever handed out at once. */
+} tmp_chunk;
+
+/* Each block is preceded by its rounded size, so that it can be popped. */
+#define TMP_HDR TMP_ROUND(sizeof(size_t))
+#define TMP_CHUNK_HDR TMP_ROUND(sizeof(tmp_chunk))
+#define CHUNK_DATA(c) ((char *) (c) + TMP_CHUNK_HDR)
+
+static __thread struct {
+    tmp_chunk *top;   /* Chunk allocations are carved from. */
+    tmp_chunk *spare; /* Emptied chunk kept for reuse. */
+    struct apm_tmp_stats stats;
+} arena;
+
+static tmp_chunk *tmp_chunk_new(size_t need)
+{
+    /* Chunks grow geometrically, so that a deepening stack takes few of them,
+     * but to no more than twice what the request needs: a small temporary
+     * after a large one gets a small chunk. */
+    const size_t least = need > TMP_CHUNK_MIN ? need : TMP_CHUNK_MIN;
+    size_t size = arena.top ? arena.top->size * 2 : least;
+    if (size < least)
+        size = least;
+    else if (size / 2 > least)
+        size = least * 2;
+
+    tmp_chunk *c;
+    if (arena.spare && arena.spare->size >= need) {
+        c = arena.spare;
+        arena.spare = NULL;
+    } else {
+        c = MALLOC(TMP_CHUNK_HDR + size);
+        c->size = size;
+        arena.stats.reserved += size;
+        arena.stats.chunks++;
+    }
+    c->prev = arena.top;
+    c->used = 0;
+    c->high = 0;
+    return c;
+}
+
+static void tmp_chunk_free(tmp_chunk *c)
+{
+    arena.stats.reserved -= c->size;
+    FREE(c);
+}
+
+void *apm_tmp_alloc(size_t size)
+{
+    ASSERT(size != 0);
+
+    const size_t need = TMP_HDR + TMP_ROUND(size);
+    tmp_chunk *c = arena.top;
+    if (!c || c->size - c->used < need) {
+        /* An empty chunk which is too small is replaced rather than kept
+         * below the new one. */
+        if (c && c->used == 0) {
+            arena.top = c->prev;
+            tmp_chunk_free(c);
+        }
+        arena.top = c = tmp_chunk_new(need);
+    }
+
+    char *p = CHUNK_DATA(c) + c->used;
+    *(size_t *) p = need;
+    c->used += need;
+    if (c->used > c->high)
+        c->high = c->used;
+
+    arena.stats.in_use += need;
+    if (arena.stats.in_use > arena.stats.peak)
+        arena.stats.peak = arena.stats.in_use;
+    return p + TMP_HDR;
+}
+
+void apm_tmp_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    char *p = (char *) ptr - TMP_HDR;
+    const size_t need = *(size_t *) p;
+    tmp_chunk *c = arena.top;
+    /* Temporaries MUST be released in stack order. */
+    ASSERT(c && p + need == CHUNK_DATA(c) + c->used);
+
+    c->used -= need;
+    arena.stats.in_use -= need;
+    if (c->used == 0 && c->prev) {
+        /* Pop the chunk, but keep the larger of it and the cached one,
+         * unless most of it went unused: the spare is held for the next
+         * pass of the same operation, which would not use it either. */
+        arena.top = c->prev;
+        if (c->size > 2 * (c->high > TMP_CHUNK_MIN ? c->high : TMP_CHUNK_MIN)) {
+            tmp_chunk_free(c);
+            return;
+        }
+        if (arena.spare && arena.spare->size < c->size) {
+            tmp_chunk_free(arena.spare);
+            arena.spare = NULL;
+        }
+        if (!arena.spare)
+            arena.spare = c;
+        else
+            tmp_chunk_free(c);
+    }
+}
+
+void apm_tmp_trim(void)
+{
+    if (arena.spare) {
+        tmp_chunk_free(arena.spare);
+        arena.spare = NULL;
+    }
+    if (arena.top && arena.top->used == 0) {
+        ASSERT(arena.top->prev == NULL);
+        tmp_chunk_free(arena.top);
+        arena.top = NULL;
+    }
+}
+
+void apm_tmp_get_stats(struct apm_tmp_stats *stats)
+{
+    *stats = arena.stats;
+}
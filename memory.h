@@ -5,17 +5,45 @@
 #include <stdlib.h>
 #include <string.h>
 
-static void *(*orig_malloc)(size_t) = malloc;
-static void *(*orig_realloc)(void *, size_t) = realloc;
-static void (*orig_free)(void *) = free;
+/* Allocator hooks. Every allocation of the library, including the chunks of
+ * the temporary arena below, goes through them, and each hook receives the
+ * user data pointer given along with it.
+ */
+typedef void *(*apm_malloc_fn)(size_t size, void *ud);
+typedef void *(*apm_realloc_fn)(void *ptr, size_t size, void *ud);
+typedef void (*apm_free_fn)(void *ptr, void *ud);
 
-/* TODO: implement custom memory allocator which fits arbitrary precision
- * operations
+/* Install the hooks; NULL arguments select the C library functions. This MUST
+ * happen while no memory obtained through the previous hooks is live in any
+ * thread, since it would be released through the new ones, and while no
+ * products are running. Cached arena chunks of the calling thread are
+ * released before the switch, and the thread pool (see apm_set_threads) is
+ * stopped, releasing those of its workers, and started again with the same
+ * number of threads under the new hooks. Other threads MUST call
+ * apm_tmp_trim themselves beforehand.
  */
+void apm_set_allocator(apm_malloc_fn malloc_fn,
+                       apm_realloc_fn realloc_fn,
+                       apm_free_fn free_fn,
+                       void *ud);
+/* Retrieve the installed hooks, e.g. to chain to them. */
+void apm_get_allocator(apm_malloc_fn *malloc_fn,
+                       apm_realloc_fn *realloc_fn,
+                       apm_free_fn *free_fn,
+                       void **ud);
+
+struct _apm_allocator {
+    apm_malloc_fn malloc_fn;
+    apm_realloc_fn realloc_fn;
+    apm_free_fn free_fn;
+    void *ud;
+};
+extern struct _apm_allocator _apm_allocator;
+
 static inline void *xmalloc(size_t size)
 {
     void *p;
-    if (!(p = (*orig_malloc)(size))) {
+    if (!(p = _apm_allocator.malloc_fn(size, _apm_allocator.ud))) {
         fprintf(stderr, "Out of memory.\n");
         abort();
     }
@@ -24,8 +52,8 @@ static inline void *xmalloc(size_t size)
 
 static inline void *xrealloc(void *ptr, size_t size)
 {
-    void *p;
-    if (!(p = (*orig_realloc)(ptr, size)) && size != 0) {
+    void *p = _apm_allocator.realloc_fn(ptr, size, _apm_allocator.ud);
+    if (!p && size != 0) {
         fprintf(stderr, "Out of memory.\n");
         abort();
     }
@@ -34,11 +62,36 @@ static inline void *xrealloc(void *ptr, size_t size)
 
 static inline void xfree(void *ptr)
 {
-    (*orig_free)(ptr);
+    _apm_allocator.free_fn(ptr, _apm_allocator.ud);
 }
 
 #define MALLOC(n) xmalloc(n)
 #define REALLOC(p, n) xrealloc(p, n)
 #define FREE(p) xfree(p)
 
+/* Stack allocator for the temporaries of arbitrary precision operations.
+ *
+ * Temporaries are always released in the reverse order of their allocation,
+ * so they are carved out of large chunks by bumping a pointer and given back
+ * by moving it back. A chunk which runs out is followed by one twice as large,
+ * but no more than twice the size of the request, so that the chunks held stay
+ * within a small factor of the peak use; the emptied chunk on top is kept for
+ * reuse, so a loop repeating the same operation stops calling the system
+ * allocator after its first pass. Every thread has an arena of its own.
+ */
+void *apm_tmp_alloc(size_t size);
+/* Release P, which MUST be the most recent live allocation, or NULL. */
+void apm_tmp_free(void *p);
+/* Return all chunks not in use to the system allocator. */
+void apm_tmp_trim(void);
+
+struct apm_tmp_stats {
+    size_t in_use;   /* Bytes currently allocated. */
+    size_t peak;     /* Largest value in_use has reached. */
+    size_t reserved; /* Bytes held in chunks, including the cached one. */
+    size_t chunks;   /* Number of chunks obtained from MALLOC so far. */
+};
+/* Retrieve the statistics of the arena of the calling thread. */
+void apm_tmp_get_stats(struct apm_tmp_stats *stats);
+
 #endif /* !_MEMORY_H_ */
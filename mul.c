@@ -1,6 +1,8 @@
 #include <stdbool.h>
 
 #include "apm.h"
+#include "cpu.h"
+#include "pool.h"
 
 /* Multiply u[usize] by v[vsize] and store the result in w[usize + vsize],
  * using the simple quadratic-time algorithm.
@@ -10,34 +12,130 @@ void _apm_mul_base(const apm_digit *u,
                    const apm_digit *v,
                    apm_size vsize,
                    apm_digit *w)
+{
+    _apm_kernels.mul_base(u, usize, v, vsize, w);
+}
+
+void _apm_mul_base_c(const apm_digit *u,
+                     apm_size usize,
+                     const apm_digit *v,
+                     apm_size vsize,
+                     apm_digit *w)
 {
     ASSERT(usize >= vsize);
 
     /* Find real sizes and zero any part of answer which will not be set. */
     apm_size ul = apm_rsize(u, usize);
     apm_size vl = apm_rsize(v, vsize);
+    /* One or both are zero. */
+    if (!ul || !vl) {
+        apm_zero(w, usize + vsize);
+        return;
+    }
     /* Zero digits which will not be set in multiply-and-add loop. */
     if (ul + vl != usize + vsize)
         apm_zero(w + (ul + vl), usize + vsize - (ul + vl));
-    /* One or both are zero. */
-    if (!ul || !vl)
-        return;
 
     /* Now multiply by forming partial products and adding them to the result
      * so far. Rather than zero the low ul digits of w before starting, we
      * store, rather than add, the first partial product.
      */
     apm_digit *wp = w + ul;
-    *wp = apm_dmul(u, ul, *v, w);
+    *wp = _apm_kernels.dmul(u, ul, *v, w);
     while (--vl) {
         apm_digit vd = *++v;
-        *++wp = apm_dmul_add(u, ul, vd, ++w);
+        *++wp = _apm_kernels.dmul_add(u, ul, vd, ++w);
     }
 }
 
-/* TODO: switch to Schönhage–Strassen algorithm
- * https://en.wikipedia.org/wiki/Sch%C3%B6nhage%E2%80%93Strassen_algorithm
+extern void _apm_mul_ssa(const apm_digit *u,
+                         apm_size usize,
+                         const apm_digit *v,
+                         apm_size vsize,
+                         apm_digit *w);
+extern bool _apm_mul_ntt(const apm_digit *u,
+                         apm_size usize,
+                         const apm_digit *v,
+                         apm_size vsize,
+                         apm_digit *w);
+
+static apm_fft_backend fft_backend = APM_FFT_SSA;
+
+void apm_set_fft_backend(apm_fft_backend backend)
+{
+    fft_backend = backend;
+}
+
+/* Return true if a product with a vsize-digit smaller operand, or a square if
+ * SQR, is large enough for the selected transform.
  */
+bool _apm_fft_wanted(apm_size vsize, bool sqr)
+{
+    switch (fft_backend) {
+    case APM_FFT_NTT:
+        return vsize >= (sqr ? NTT_SQR_THRESHOLD : NTT_MUL_THRESHOLD);
+    case APM_FFT_SSA:
+        return vsize >= (sqr ? SSA_SQR_THRESHOLD : SSA_MUL_THRESHOLD);
+    default:
+        return false;
+    }
+}
+
+/* Set w[usize + vsize] = u[usize] * v[vsize], usize >= vsize, with the
+ * selected transform, or the square of U if U == V. Return false if the
+ * operands are below the cutoff of the backend, leaving w untouched.
+ * The transforms allocate their own, single, temporary buffer.
+ */
+bool _apm_mul_fft(const apm_digit *u,
+                  apm_size usize,
+                  const apm_digit *v,
+                  apm_size vsize,
+                  apm_digit *w)
+{
+    if (!_apm_fft_wanted(vsize, u == v && usize == vsize))
+        return false;
+    /* Beyond the reach of the three primes, SSA has no such limit. */
+    if (fft_backend != APM_FFT_NTT || !_apm_mul_ntt(u, usize, v, vsize, w))
+        _apm_mul_ssa(u, usize, v, vsize, w);
+    return true;
+}
+
+static void apm_mul_toom3(const apm_digit *u,
+                          const apm_digit *v,
+                          apm_size size,
+                          apm_digit *w,
+                          apm_digit *scratch);
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* Scratch space used by the Karatsuba and Toom-Cook recursion of
+ * apm_mul_n_scratch at this size and below. Each level takes its temporaries
+ * from the front of the buffer and passes the rest on to the sub-products,
+ * which run one at a time.
+ */
+static apm_size apm_mul_n_tmp_size(apm_size size)
+{
+    if (_apm_fft_wanted(size, false) || size < KARATSUBA_MUL_THRESHOLD)
+        return 0;
+
+    if (size >= TOOM3_MUL_THRESHOLD) {
+        const apm_size k = (size + 2) / 3, r = size - 2 * k;
+        apm_size sub = MAX(apm_mul_n_tmp_size(k), apm_mul_n_tmp_size(k + 1));
+        sub = MAX(sub, apm_mul_n_tmp_size(r));
+        return 12 * (k + 1) + sub;
+    }
+
+    const apm_size even_size = size & ~1;
+    return 2 * even_size + apm_mul_n_tmp_size(even_size / 2);
+}
+
+apm_size apm_mul_n_scratch_size(apm_size size)
+{
+    /* Equal operands are passed on to apm_sqr_scratch. */
+    return MAX(apm_mul_n_tmp_size(size), apm_sqr_scratch_size(size));
+}
 
 /* Karatsuba multiplication [cf. Knuth 4.3.3, vol.2, 3rd ed, pp.294-295]
  * Given U = U1*2^N + U0 and V = V1*2^N + V0,
@@ -50,16 +148,22 @@ void _apm_mul_base(const apm_digit *u,
  * in the additions, and this will slow down the routine.  However, if we use
  * the first formula the middle terms will not grow larger than N bits.
  */
-static void apm_mul_n(const apm_digit *u,
-                      const apm_digit *v,
-                      apm_size size,
-                      apm_digit *w)
+void apm_mul_n_scratch(const apm_digit *u,
+                       const apm_digit *v,
+                       apm_size size,
+                       apm_digit *w,
+                       apm_digit *scratch)
 {
-    /* TODO: Only allocate a temporary buffer which is large enough for all
-     * following recursive calls, rather than allocating at each call.
-     */
     if (u == v) {
-        apm_sqr(u, size, w);
+        apm_sqr_scratch(u, size, w, scratch);
+        return;
+    }
+
+    if (_apm_mul_fft(u, size, v, size, w))
+        return;
+
+    if (size >= TOOM3_MUL_THRESHOLD) {
+        apm_mul_toom3(u, v, size, w, scratch);
         return;
     }
 
@@ -76,50 +180,50 @@ static void apm_mul_n(const apm_digit *u,
     const apm_digit *v0 = v, *v1 = v + half_size;
     apm_digit *w0 = w, *w1 = w + even_size;
 
+    /* Get absolute values of U1-U0 and V0-V1. */
+    apm_digit *u_tmp = scratch, *v_tmp = scratch + half_size;
+    bool prod_neg = apm_cmp_n(u1, u0, half_size) < 0;
+    if (prod_neg)
+        apm_sub_n(u0, u1, half_size, u_tmp);
+    else
+        apm_sub_n(u1, u0, half_size, u_tmp);
+    if (apm_cmp_n(v0, v1, half_size) < 0)
+        apm_sub_n(v1, v0, half_size, v_tmp), prod_neg ^= 1;
+    else
+        apm_sub_n(v0, v1, half_size, v_tmp);
+
     /* U0 * V0 => w[0..even_size-1]; */
-    /* U1 * V1 => w[even_size..2*even_size-1]. */
-    if (half_size >= KARATSUBA_MUL_THRESHOLD) {
-        apm_mul_n(u0, v0, half_size, w0);
-        apm_mul_n(u1, v1, half_size, w1);
+    /* U1 * V1 => w[even_size..2*even_size-1]; */
+    /* (U1-U0)*(V0-V1) => tmp. */
+    apm_digit *tmp = scratch + even_size;
+    if (_apm_parallel_wanted(size)) {
+        apm_mul_job jobs[3] = {
+            {u0, v0, half_size, w0},
+            {u1, v1, half_size, w1},
+            {u_tmp, v_tmp, half_size, tmp},
+        };
+        _apm_mul_jobs(jobs, 3, tmp + even_size);
+    } else if (half_size >= KARATSUBA_MUL_THRESHOLD) {
+        apm_mul_n_scratch(u0, v0, half_size, w0, tmp + even_size);
+        apm_mul_n_scratch(u1, v1, half_size, w1, tmp + even_size);
+        apm_mul_n_scratch(u_tmp, v_tmp, half_size, tmp, tmp + even_size);
     } else {
         _apm_mul_base(u0, half_size, v0, half_size, w0);
         _apm_mul_base(u1, half_size, v1, half_size, w1);
+        _apm_mul_base(u_tmp, half_size, v_tmp, half_size, tmp);
     }
 
     /* Since we cannot add w[0..even_size-1] to w[half_size ...
-     * half_size+even_size-1] in place, we have to make a copy of it now.
-     * This later gets used to store U1-U0 and V0-V1.
+     * half_size+even_size-1] in place, we have to make a copy of it now, in
+     * the space of U1-U0 and V0-V1.
      */
-    apm_digit *tmp = APM_TMP_COPY(w0, even_size);
+    apm_copy(w0, even_size, scratch);
 
     apm_digit cy;
     /* w[half_size..half_size+even_size-1] += U1*V1. */
     cy = apm_addi_n(w + half_size, w1, even_size);
     /* w[half_size..half_size+even_size-1] += U0*V0. */
-    cy += apm_addi_n(w + half_size, tmp, even_size);
-
-    /* Get absolute value of U1-U0. */
-    apm_digit *u_tmp = tmp;
-    bool prod_neg = apm_cmp_n(u1, u0, half_size) < 0;
-    if (prod_neg)
-        apm_sub_n(u0, u1, half_size, u_tmp);
-    else
-        apm_sub_n(u1, u0, half_size, u_tmp);
-
-    /* Get absolute value of V0-V1. */
-    apm_digit *v_tmp = tmp + half_size;
-    if (apm_cmp_n(v0, v1, half_size) < 0)
-        apm_sub_n(v1, v0, half_size, v_tmp), prod_neg ^= 1;
-    else
-        apm_sub_n(v0, v1, half_size, v_tmp);
-
-    /* tmp = (U1-U0)*(V0-V1). */
-    tmp = APM_TMP_ALLOC(even_size);
-    if (half_size >= KARATSUBA_MUL_THRESHOLD)
-        apm_mul_n(u_tmp, v_tmp, half_size, tmp);
-    else
-        _apm_mul_base(u_tmp, half_size, v_tmp, half_size, tmp);
-    APM_TMP_FREE(u_tmp);
+    cy += apm_addi_n(w + half_size, scratch, even_size);
 
     /* Now add / subtract (U1-U0)*(V0-V1) from
      * w[half_size..half_size+even_size-1] based on whether it is negative or
@@ -129,7 +233,6 @@ static void apm_mul_n(const apm_digit *u,
         cy -= apm_subi_n(w + half_size, tmp, even_size);
     else
         cy += apm_addi_n(w + half_size, tmp, even_size);
-    APM_TMP_FREE(tmp);
 
     /* Now if there was any carry from the middle digits (which is at most 2),
      * add that to w[even_size+half_size..2*even_size-1]. */
@@ -149,6 +252,184 @@ static void apm_mul_n(const apm_digit *u,
     }
 }
 
+/* Evaluate A(X) = A2*X^2 + A1*X + A0 at X = 1, -1 and 2, where a[2k+r] holds
+ * A0 and A1 in k digits each and A2 in r digits. Each value is stored in k+1
+ * digits. Return true if A(-1) is negative, in which case em1 holds |A(-1)|.
+ */
+bool _apm_toom3_eval(const apm_digit *a,
+                     apm_size k,
+                     apm_size r,
+                     apm_digit *e1,
+                     apm_digit *em1,
+                     apm_digit *e2)
+{
+    const apm_digit *a0 = a, *a1 = a + k, *a2 = a + 2 * k;
+
+    /* e1 = A0 + A2 */
+    apm_copy(a0, k, e1);
+    e1[k] = apm_addi(e1, k, a2, r);
+
+    /* em1 = |A0 + A2 - A1| */
+    bool neg = !e1[k] && apm_cmp_n(e1, a1, k) < 0;
+    if (neg) {
+        apm_sub_n(a1, e1, k, em1);
+        em1[k] = 0;
+    } else {
+        em1[k] = e1[k] - apm_sub_n(e1, a1, k, em1);
+    }
+
+    /* e1 = A0 + A1 + A2 */
+    e1[k] += apm_addi_n(e1, a1, k);
+
+    /* e2 = (A2 * 2 + A1) * 2 + A0; the top digit leaves room for the carry. */
+    apm_copy(a2, r, e2);
+    apm_zero(e2 + r, k + 1 - r);
+    apm_lshifti(e2, k + 1, 1);
+    apm_addi(e2, k + 1, a1, k);
+    apm_lshifti(e2, k + 1, 1);
+    apm_addi(e2, k + 1, a0, k);
+    return neg;
+}
+
+/* Interpolate W(X) = c4*X^4 + c3*X^3 + c2*X^2 + c1*X + c0 from its values at
+ * five points and store W(2^(k*APM_DIGIT_BITS)) in w[4k+2r].
+ * On entry, w[0..2k-1] holds c0 = W(0), w[4k..4k+2r-1] holds c4 = W(inf), and
+ * p1, pm1, p2 hold W(1), |W(-1)| and W(2) in 2k+2 digits each, with NEG being
+ * the sign of W(-1). The three point values are clobbered.
+ *
+ * Every coefficient is a sum of products of non-negative numbers, and the
+ * sequence below only ever forms non-negative intermediate values:
+ *	p2  = (W(2) - W(-1)) / 3	= c1 + c2 + 3c3 + 5c4
+ *	pm1 = (W(1) - W(-1)) / 2	= c1 + c3
+ *	p1  = W(1) - c0			= c1 + c2 + c3 + c4
+ *	p2  = (p2 - p1) / 2		= c3 + 2c4
+ *	p1  = p1 - pm1 - c4		= c2
+ *	p2  = p2 - 2c4			= c3
+ *	pm1 = pm1 - p2			= c1
+ */
+void _apm_toom3_interpolate(apm_digit *w,
+                            apm_size k,
+                            apm_size r,
+                            apm_digit *p1,
+                            apm_digit *pm1,
+                            apm_digit *p2,
+                            bool neg)
+{
+    const apm_size psize = 2 * k + 2;
+    const apm_size wsize = 4 * k + 2 * r;
+    const apm_digit *c0 = w, *c4 = w + 4 * k;
+
+    if (neg)
+        apm_addi_n(p2, pm1, psize);
+    else
+        ASSERT(apm_subi_n(p2, pm1, psize) == 0);
+    apm_divexact_by3(p2, psize);
+
+    if (neg)
+        apm_addi_n(pm1, p1, psize);
+    else
+        ASSERT(apm_sub_n(p1, pm1, psize, pm1) == 0);
+    apm_rshifti(pm1, psize, 1);
+
+    ASSERT(apm_subi(p1, psize, c0, 2 * k) == 0);
+
+    ASSERT(apm_subi_n(p2, p1, psize) == 0);
+    apm_rshifti(p2, psize, 1);
+
+    ASSERT(apm_subi_n(p1, pm1, psize) == 0);
+    ASSERT(apm_subi(p1, psize, c4, 2 * r) == 0);
+
+    ASSERT(apm_subi(p2, psize, c4, 2 * r) == 0);
+    ASSERT(apm_subi(p2, psize, c4, 2 * r) == 0);
+
+    ASSERT(apm_subi_n(pm1, p2, psize) == 0);
+
+    /* Recompose: w = c0 + c1*X + c2*X^2 + c3*X^3 + c4*X^4. */
+    apm_zero(w + 2 * k, 2 * k);
+    ASSERT(apm_addi(w + k, wsize - k, pm1, apm_rsize(pm1, psize)) == 0);
+    ASSERT(apm_addi(w + 2 * k, wsize - 2 * k, p1, apm_rsize(p1, psize)) == 0);
+    ASSERT(apm_addi(w + 3 * k, wsize - 3 * k, p2, apm_rsize(p2, psize)) == 0);
+}
+
+/* Toom-Cook 3-way multiplication [cf. Knuth 4.3.3, vol.2, 3rd ed, pp.294-299]
+ * Given U = U2*X^2 + U1*X + U0 and V = V2*X^2 + V1*X + V0 with
+ * X = 2^(k*APM_DIGIT_BITS), the product W(X) = U(X)*V(X) has degree 4 and is
+ * determined by its values at 0, 1, -1, 2 and infinity. That takes five
+ * multiplications of about a third of the size, rather than the nine of the
+ * schoolbook method, for an overall cost of O(n^1.465).
+ */
+static void apm_mul_toom3(const apm_digit *u,
+                          const apm_digit *v,
+                          apm_size size,
+                          apm_digit *w,
+                          apm_digit *scratch)
+{
+    const apm_size k = (size + 2) / 3;
+    const apm_size r = size - 2 * k; /* Size of U2 and V2: 0 < r <= k. */
+    const apm_size esize = k + 1;     /* Size of the evaluated operands. */
+    const apm_size psize = 2 * esize; /* Size of the point-wise products. */
+
+    apm_digit *ue1 = scratch, *um1 = ue1 + esize, *ue2 = um1 + esize;
+    apm_digit *ve1 = ue2 + esize, *vm1 = ve1 + esize, *ve2 = vm1 + esize;
+    apm_digit *p1 = ve2 + esize, *pm1 = p1 + psize, *p2 = pm1 + psize;
+    apm_digit *rest = p2 + psize;
+
+    bool neg = _apm_toom3_eval(u, k, r, ue1, um1, ue2);
+    neg ^= _apm_toom3_eval(v, k, r, ve1, vm1, ve2);
+
+    /* W(0) => w[0..2k-1], W(inf) => w[4k..] */
+    if (_apm_parallel_wanted(size)) {
+        apm_mul_job jobs[5] = {
+            {ue1, ve1, esize, p1},   {um1, vm1, esize, pm1},
+            {ue2, ve2, esize, p2},   {u, v, k, w},
+            {u + 2 * k, v + 2 * k, r, w + 4 * k},
+        };
+        _apm_mul_jobs(jobs, 5, rest);
+    } else {
+        apm_mul_n_scratch(u, v, k, w, rest);
+        apm_mul_n_scratch(u + 2 * k, v + 2 * k, r, w + 4 * k, rest);
+        apm_mul_n_scratch(ue1, ve1, esize, p1, rest);
+        apm_mul_n_scratch(um1, vm1, esize, pm1, rest);
+        apm_mul_n_scratch(ue2, ve2, esize, p2, rest);
+    }
+
+    _apm_toom3_interpolate(w, k, r, p1, pm1, p2, neg);
+}
+
+static void mul_job_run(void *arg)
+{
+    apm_mul_job *job = arg;
+    apm_mul_n_scratch(job->u, job->v, job->size, job->w, job->scratch);
+}
+
+void _apm_mul_jobs(apm_mul_job *jobs, unsigned int n, apm_digit *scratch)
+{
+    apm_task tasks[5];
+    ASSERT(n <= 5);
+
+    /* The spawned products each take their part of one buffer. */
+    apm_size total = 0;
+    for (unsigned int i = 1; i < n; i++) {
+        total += jobs[i].u == jobs[i].v ? apm_sqr_scratch_size(jobs[i].size)
+                                        : apm_mul_n_scratch_size(jobs[i].size);
+    }
+    apm_digit *more = total ? APM_TMP_ALLOC(total) : NULL;
+
+    jobs[0].scratch = scratch;
+    for (unsigned int i = 1, used = 0; i < n; i++) {
+        jobs[i].scratch = more ? more + used : NULL;
+        used += jobs[i].u == jobs[i].v ? apm_sqr_scratch_size(jobs[i].size)
+                                       : apm_mul_n_scratch_size(jobs[i].size);
+        _apm_task_spawn(&tasks[i], mul_job_run, &jobs[i]);
+    }
+    mul_job_run(&jobs[0]);
+    for (unsigned int i = n; --i > 0;)
+        _apm_task_wait(&tasks[i]);
+
+    if (more)
+        APM_TMP_FREE(more);
+}
+
 void apm_mul(const apm_digit *u,
              apm_size usize,
              const apm_digit *v,
@@ -184,10 +465,23 @@ void apm_mul(const apm_digit *u,
         return;
     }
 
-    apm_mul_n(u, v, vsize, w);
-    if (usize == vsize)
+    /* The transforms take unbalanced operands as they are. */
+    if (_apm_mul_fft(u, usize, v, vsize, w))
         return;
 
+    /* One buffer serves the whole recursion, plus room for the partial
+     * products of unbalanced operands. */
+    const apm_size scratch_size = apm_mul_n_scratch_size(vsize);
+    apm_digit *scratch =
+        APM_TMP_ALLOC(scratch_size + (usize > vsize ? vsize * 2 : 0));
+    apm_digit *tmp = scratch + scratch_size;
+
+    apm_mul_n_scratch(u, v, vsize, w, scratch);
+    if (usize == vsize) {
+        APM_TMP_FREE(scratch);
+        return;
+    }
+
     apm_size wsize = usize + vsize;
     apm_zero(w + (vsize * 2), wsize - (vsize * 2));
     w += vsize;
@@ -195,22 +489,16 @@ void apm_mul(const apm_digit *u,
     u += vsize;
     usize -= vsize;
 
-    apm_digit *tmp = NULL;
-    if (usize >= vsize) {
-        tmp = APM_TMP_ALLOC(vsize * 2);
-        do {
-            apm_mul_n(u, v, vsize, tmp);
-            ASSERT(apm_addi(w, wsize, tmp, vsize * 2) == 0);
-            w += vsize;
-            wsize -= vsize;
-            u += vsize;
-            usize -= vsize;
-        } while (usize >= vsize);
+    while (usize >= vsize) {
+        apm_mul_n_scratch(u, v, vsize, tmp, scratch);
+        ASSERT(apm_addi(w, wsize, tmp, vsize * 2) == 0);
+        w += vsize;
+        wsize -= vsize;
+        u += vsize;
+        usize -= vsize;
     }
 
     if (usize) { /* Size of U isn't a multiple of size of V. */
-        if (!tmp)
-            tmp = APM_TMP_ALLOC(usize + vsize);
         /* Now usize < vsize. Rearrange operands. */
         if (usize < KARATSUBA_MUL_THRESHOLD)
             _apm_mul_base(v, vsize, u, usize, tmp);
@@ -218,5 +506,5 @@ void apm_mul(const apm_digit *u,
             apm_mul(v, vsize, u, usize, tmp);
         ASSERT(apm_addi(w, wsize, tmp, usize + vsize) == 0);
     }
-    APM_TMP_FREE(tmp);
+    APM_TMP_FREE(scratch);
 }
@@ -0,0 +1,397 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "apm.h"
+#include "pool.h"
+
+/* Number-theoretic transform multiplication
+ * [cf. Pollard, "The fast Fourier transform in a finite field", 1971]
+ *
+ * Every digit of the operands is taken as one coefficient, and the acyclic
+ * convolution of the two digit sequences is computed modulo three primes
+ * p = c*2^e + 1 just below 2^(APM_DIGIT_BITS-2), for which Z/pZ has roots of
+ * unity of order 2^e. Each coefficient of the integer convolution is less than
+ * min(usize, vsize) * 2^(2*APM_DIGIT_BITS) < p1*p2*p3, so the Chinese
+ * remainder theorem recovers it exactly from its three residues. Unlike
+ * Schönhage–Strassen, the butterflies operate on single digits, which keeps
+ * the inner loops short and regular.
+ *
+ * Arithmetic modulo p uses Montgomery's reduction with R = 2^APM_DIGIT_BITS:
+ * the twiddle factors are kept in Montgomery form, so multiplying by them
+ * leaves the data in ordinary form. p < R/4 leaves enough headroom for the
+ * reduction to need at most one final subtraction.
+ */
+
+/* The primes in ascending order, with a primitive root and the exponent of the
+ * largest power of two dividing p - 1.
+ */
+static const struct {
+    apm_digit p;
+    apm_digit g;
+    unsigned int lg;
+} ntt_primes[3] = {
+#if APM_DIGIT_SIZE == 4
+    {0x0A000001U, 3, 25},
+    {0x1C000001U, 3, 26},
+    {0x2D000001U, 11, 24},
+#elif APM_DIGIT_SIZE == 8
+    {UINT64_C(0x3FFF840000000001), 19, 42},
+    {UINT64_C(0x3FFFBE0000000001), 3, 41},
+    {UINT64_C(0x3FFFC00000000001), 11, 46},
+#endif
+};
+
+/* Longest transform, and largest operand for which the convolution does not
+ * exceed the product of the three primes.
+ */
+#if APM_DIGIT_SIZE == 4
+#define NTT_MAX_LG 24
+#define NTT_MAX_VSIZE (UINT32_C(1) << 21)
+#elif APM_DIGIT_SIZE == 8
+#define NTT_MAX_LG 41
+#define NTT_MAX_VSIZE UINT32_MAX
+#endif
+
+typedef struct {
+    apm_digit p;    /* The prime. */
+    apm_digit pinv; /* -p^-1 mod R. */
+    apm_digit r2;   /* R^2 mod p. */
+} ntt_mod;
+
+static void ntt_mod_init(ntt_mod *m, apm_digit p)
+{
+    /* Newton iteration doubles the number of correct low bits, starting with
+     * three since p * p = 1 mod 8 for odd p. */
+    apm_digit inv = p;
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - p * inv;
+    m->p = p;
+    m->pinv = -inv;
+
+    apm_digit q, r, hi, lo;
+    digit_div(1, 0, p, q, r); /* r = R mod p */
+    digit_mul(r, r, hi, lo);
+    digit_div(hi, lo, p, q, r);
+    m->r2 = r;
+    (void) q;
+}
+
+/* Return a * b / R mod p. */
+static inline apm_digit ntt_mul(apm_digit a, apm_digit b, const ntt_mod *m)
+{
+    apm_digit hi, lo, mh, ml;
+    digit_mul(a, b, hi, lo);
+    const apm_digit t = lo * m->pinv;
+    digit_mul(t, m->p, mh, ml);
+    /* lo + ml = 0 mod R, with a carry out unless both are zero. */
+    const apm_digit s = hi + mh + (lo != 0);
+    (void) ml;
+    return s >= m->p ? s - m->p : s;
+}
+
+static inline apm_digit ntt_add(apm_digit a, apm_digit b, const ntt_mod *m)
+{
+    const apm_digit s = a + b;
+    return s >= m->p ? s - m->p : s;
+}
+
+static inline apm_digit ntt_sub(apm_digit a, apm_digit b, const ntt_mod *m)
+{
+    return a >= b ? a - b : a - b + m->p;
+}
+
+/* Convert a to Montgomery form, a * R mod p. */
+static inline apm_digit ntt_to_mont(apm_digit a, const ntt_mod *m)
+{
+    return ntt_mul(a, m->r2, m);
+}
+
+/* Return a^e, with a and the result in Montgomery form. */
+static apm_digit ntt_pow(apm_digit a, apm_digit e, const ntt_mod *m)
+{
+    apm_digit r = ntt_to_mont(1, m);
+    for (; e; e >>= 1) {
+        if (e & 1)
+            r = ntt_mul(r, a, m);
+        a = ntt_mul(a, a, m);
+    }
+    return r;
+}
+
+/* One stage of butterflies of a transform, on blocks of 2 * HALF elements,
+ * with the twiddle factors T.
+ */
+typedef struct {
+    apm_digit *a;
+    const apm_digit *t;
+    size_t half;
+    const ntt_mod *m;
+} ntt_stage;
+
+/* Run the butterflies of index [lo, hi) of a forward stage: decimation in
+ * frequency.
+ */
+static void ntt_fft_range(void *arg, size_t lo, size_t hi)
+{
+    const ntt_stage *st = arg;
+    const size_t half = st->half;
+    const apm_digit *t = st->t;
+    const ntt_mod *m = st->m;
+
+    size_t j0 = lo % half;
+    apm_digit *x = st->a + 2 * (lo - j0);
+    for (size_t b = lo; b < hi; x += 2 * half, j0 = 0) {
+        const size_t j1 = hi - b < half - j0 ? j0 + (hi - b) : half;
+        apm_digit *y = x + half;
+        for (size_t j = j0; j < j1; j++) {
+            const apm_digit xd = x[j], yd = y[j];
+            x[j] = ntt_add(xd, yd, m);
+            y[j] = ntt_mul(ntt_sub(xd, yd, m), t[j], m);
+        }
+        b += j1 - j0;
+    }
+}
+
+/* As ntt_fft_range, for an inverse stage: decimation in time. */
+static void ntt_ifft_range(void *arg, size_t lo, size_t hi)
+{
+    const ntt_stage *st = arg;
+    const size_t half = st->half;
+    const apm_digit *t = st->t;
+    const ntt_mod *m = st->m;
+
+    size_t j0 = lo % half;
+    apm_digit *x = st->a + 2 * (lo - j0);
+    for (size_t b = lo; b < hi; x += 2 * half, j0 = 0) {
+        const size_t j1 = hi - b < half - j0 ? j0 + (hi - b) : half;
+        apm_digit *y = x + half;
+        for (size_t j = j0; j < j1; j++) {
+            const apm_digit xd = x[j], yd = ntt_mul(y[j], t[j], m);
+            x[j] = ntt_add(xd, yd, m);
+            y[j] = ntt_sub(xd, yd, m);
+        }
+        b += j1 - j0;
+    }
+}
+
+/* Butterflies per range of a parallel stage. */
+#define NTT_GRAIN 4096
+
+/* Forward transform, from natural order input to bit-reversed output.
+ * tw[h + j], j < h, is the j-th power of the primitive 2h-th root of unity in
+ * Montgomery form, so that every stage of butterflies walks its twiddle
+ * factors sequentially. The butterflies of each stage are independent, so
+ * with PAR they are spread over the threads.
+ */
+static void ntt_fft(apm_digit *a,
+                    unsigned int lg,
+                    const apm_digit *tw,
+                    const ntt_mod *m,
+                    bool par)
+{
+    const size_t K = (size_t) 1 << lg;
+    for (size_t half = K / 2; half; half >>= 1) {
+        ntt_stage st = {a, tw + half, half, m};
+        if (par)
+            _apm_parallel_for(K / 2, NTT_GRAIN, ntt_fft_range, &st);
+        else
+            ntt_fft_range(&st, 0, K / 2);
+    }
+}
+
+/* Inverse transform, from bit-reversed order input to natural output, scaled
+ * by K. itw is laid out as tw, for the inverse root.
+ */
+static void ntt_ifft(apm_digit *a,
+                     unsigned int lg,
+                     const apm_digit *itw,
+                     const ntt_mod *m,
+                     bool par)
+{
+    const size_t K = (size_t) 1 << lg;
+    for (size_t half = 1; half < K; half <<= 1) {
+        ntt_stage st = {a, itw + half, half, m};
+        if (par)
+            _apm_parallel_for(K / 2, NTT_GRAIN, ntt_ifft_range, &st);
+        else
+            ntt_ifft_range(&st, 0, K / 2);
+    }
+}
+
+/* Fill tw[1..K-1] with the twiddle factors for the primitive K-th root of
+ * unity w, given in Montgomery form.
+ */
+static void ntt_twiddles(apm_digit *tw, size_t K, apm_digit w, const ntt_mod *m)
+{
+    apm_digit *t = tw + K / 2;
+    t[0] = ntt_to_mont(1, m);
+    for (size_t j = 1; j < K / 2; j++)
+        t[j] = ntt_mul(t[j - 1], w, m);
+    /* The 2h-th root of unity is the square of the 4h-th one. */
+    for (size_t half = K / 4; half; half >>= 1) {
+        for (size_t j = 0; j < half; j++)
+            tw[half + j] = tw[2 * half + 2 * j];
+    }
+}
+
+/* Reduce u[usize] digit-wise modulo p into a[K], zero-padded. */
+static void ntt_load(const apm_digit *u,
+                     apm_size usize,
+                     apm_digit *a,
+                     size_t K,
+                     const ntt_mod *m)
+{
+    for (apm_size i = 0; i < usize; i++) {
+        apm_digit d = u[i];
+        while (d >= m->p)
+            d -= m->p;
+        a[i] = d;
+    }
+    apm_zero(a + usize, K - usize);
+}
+
+/* Compute the cyclic convolution of u and v modulo the I-th prime into r[K].
+ * Returns with r in ordinary form. B is scratch space of K digits, unused
+ * when squaring, and TW of 2K digits. PAR spreads the transforms over the
+ * threads.
+ */
+static void ntt_convolve(const apm_digit *u,
+                         apm_size usize,
+                         const apm_digit *v,
+                         apm_size vsize,
+                         bool sqr,
+                         unsigned int lg,
+                         int i,
+                         apm_digit *r,
+                         apm_digit *b,
+                         apm_digit *tw,
+                         bool par)
+{
+    const size_t K = (size_t) 1 << lg;
+    apm_digit *itw = tw + K;
+    ntt_mod m;
+    ntt_mod_init(&m, ntt_primes[i].p);
+
+    /* w = g^((p-1)/K) is a primitive K-th root of unity. */
+    const apm_digit g = ntt_to_mont(ntt_primes[i].g, &m);
+    const apm_digit w = ntt_pow(g, (m.p - 1) >> lg, &m);
+    ntt_twiddles(tw, K, w, &m);
+    ntt_twiddles(itw, K, ntt_pow(w, K - 1, &m), &m);
+
+    /* The point-wise products carry a factor R^-1 and the inverse transform a
+     * factor K, so they are multiplied by R^2/K: K^-1 in Montgomery form,
+     * twice. */
+    const apm_digit kinv = ntt_pow(ntt_to_mont(K % m.p, &m), m.p - 2, &m);
+    const apm_digit scale = ntt_to_mont(kinv, &m);
+
+    ntt_load(u, usize, r, K, &m);
+    ntt_fft(r, lg, tw, &m, par);
+    if (sqr) {
+        for (size_t j = 0; j < K; j++)
+            r[j] = ntt_mul(ntt_mul(r[j], r[j], &m), scale, &m);
+    } else {
+        ntt_load(v, vsize, b, K, &m);
+        ntt_fft(b, lg, tw, &m, par);
+        for (size_t j = 0; j < K; j++)
+            r[j] = ntt_mul(ntt_mul(r[j], b[j], &m), scale, &m);
+    }
+    ntt_ifft(r, lg, itw, &m, par);
+}
+
+/* The convolutions modulo a range of the primes, into r[3K]. Each uses EACH
+ * digits of TMP for its twiddle factors and scratch space, a separate part of
+ * it with PAR, when they run at the same time.
+ */
+typedef struct {
+    const apm_digit *u, *v;
+    apm_size usize, vsize;
+    bool sqr, par;
+    unsigned int lg;
+    apm_digit *r, *tmp;
+    size_t each;
+} ntt_convolutions;
+
+static void ntt_convolve_task(void *arg, size_t lo, size_t hi)
+{
+    const ntt_convolutions *c = arg;
+    const size_t K = (size_t) 1 << c->lg;
+    for (size_t i = lo; i < hi; i++) {
+        apm_digit *tw = c->tmp + (c->par ? i * c->each : 0);
+        ntt_convolve(c->u, c->usize, c->v, c->vsize, c->sqr, c->lg, (int) i,
+                     c->r + i * K, tw + 2 * K, tw, c->par);
+    }
+}
+
+/* Set w[usize + vsize] = u[usize] * v[vsize] with a three-prime NTT, where
+ * U == V (and usize == vsize) selects squaring. Return false, leaving w
+ * untouched, if the operands are too large for the primes. Above the parallel
+ * cutoff, the three convolutions, and the butterflies of their transforms,
+ * are spread over the threads.
+ */
+bool _apm_mul_ntt(const apm_digit *u,
+                  apm_size usize,
+                  const apm_digit *v,
+                  apm_size vsize,
+                  apm_digit *w)
+{
+    const bool sqr = (u == v && usize == vsize);
+    const size_t wsize = (size_t) usize + vsize;
+    const apm_size minsize = usize < vsize ? usize : vsize;
+
+    unsigned int lg = 0;
+    while (((size_t) 1 << lg) < wsize - 1)
+        ++lg;
+    if (lg > NTT_MAX_LG || minsize > NTT_MAX_VSIZE)
+        return false;
+    if (lg < 1)
+        lg = 1;
+    const size_t K = (size_t) 1 << lg;
+
+    const bool par = _apm_parallel_wanted(minsize);
+    const size_t each = 2 * K + (sqr ? 0 : K);
+    apm_digit *r = APM_TMP_ALLOC(3 * K + (par ? 3 : 1) * each);
+    ntt_convolutions c = {u, v, usize, vsize, sqr, par, lg, r, r + 3 * K, each};
+    if (par)
+        _apm_parallel_for(3, 1, ntt_convolve_task, &c);
+    else
+        ntt_convolve_task(&c, 0, 3);
+
+    /* Garner's algorithm: with residues r1, r2, r3 and x1 = r1,
+     *	x2 = (r2 - x1) / p1 mod p2
+     *	x3 = ((r3 - x1) / p1 - x2) / p2 mod p3
+     * the coefficient is x1 + p1 * (x2 + p2 * x3). */
+    ntt_mod m2, m3;
+    ntt_mod_init(&m2, ntt_primes[1].p);
+    ntt_mod_init(&m3, ntt_primes[2].p);
+    const apm_digit p1 = ntt_primes[0].p, p2 = ntt_primes[1].p;
+    const apm_digit inv12 =
+        ntt_pow(ntt_to_mont(p1, &m2), m2.p - 2, &m2); /* p1^-1 * R mod p2 */
+    const apm_digit inv13 = ntt_pow(ntt_to_mont(p1, &m3), m3.p - 2, &m3);
+    const apm_digit inv23 = ntt_pow(ntt_to_mont(p2, &m3), m3.p - 2, &m3);
+
+    const apm_digit *r1 = r, *r2 = r + K, *r3 = r + 2 * K;
+    apm_digit cy[2] = {0, 0};
+    for (size_t j = 0; j < wsize; j++) {
+        apm_digit x[3] = {0, 0, 0};
+        if (j < wsize - 1) {
+            const apm_digit x1 = r1[j];
+            const apm_digit x2 = ntt_mul(ntt_sub(r2[j], x1, &m2), inv12, &m2);
+            apm_digit x3 = ntt_mul(ntt_sub(r3[j], x1, &m3), inv13, &m3);
+            x3 = ntt_mul(ntt_sub(x3, x2, &m3), inv23, &m3);
+
+            apm_digit t[2];
+            digit_mul(x3, p2, t[1], t[0]);
+            t[1] += apm_daddi(t, 1, x2);
+            x[2] = apm_dmul(t, 2, p1, x);
+            apm_daddi(x, 3, x1);
+        }
+        /* Add the carry from the lower coefficients and emit one digit. */
+        x[2] += apm_addi_n(x, cy, 2);
+        w[j] = x[0];
+        cy[0] = x[1];
+        cy[1] = x[2];
+    }
+    ASSERT(cy[0] == 0 && cy[1] == 0);
+    APM_TMP_FREE(r);
+    return true;
+}
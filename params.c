@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "apm.h"
+
+/* The cutoffs between the multiplication algorithms.
+ *
+ * They are compiled in from the defaults in apm_internal.h, which "make tune"
+ * replaces with values measured on the build host, and may be overridden at
+ * run time from a profile written by the same tool. The environment variable
+ * APM_TUNE names a profile to load before main() runs, so a binary built
+ * elsewhere can still use cutoffs measured where it runs.
+ */
+
+apm_thresholds _apm_thresholds = {
+    BASE_SQR_DEFAULT, KARATSUBA_MUL_DEFAULT, KARATSUBA_SQR_DEFAULT,
+    TOOM3_MUL_DEFAULT, TOOM3_SQR_DEFAULT, SSA_MUL_DEFAULT,
+    SSA_SQR_DEFAULT, NTT_MUL_DEFAULT, NTT_SQR_DEFAULT, PARALLEL_DEFAULT,
+};
+
+/* Profile field names, with the smallest value each algorithm handles: a
+ * Karatsuba split needs two digits, a Toom-3 split a nonempty top third, and
+ * the point-wise products of Schönhage–Strassen must be smaller than the
+ * operands for its recursion to end.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+    apm_size min;
+} fields[] = {
+#define FIELD(name, min) {#name, offsetof(apm_thresholds, name), min}
+    FIELD(base_sqr, 0),  FIELD(karatsuba_mul, 2), FIELD(karatsuba_sqr, 2),
+    FIELD(toom3_mul, 5), FIELD(toom3_sqr, 5),     FIELD(ssa_mul, 64),
+    FIELD(ssa_sqr, 64),  FIELD(ntt_mul, 1),       FIELD(ntt_sqr, 1),
+    FIELD(parallel, 2),
+#undef FIELD
+};
+
+#define N_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+#define FIELD_AT(t, i) (*(apm_size *) ((char *) (t) + fields[i].offset))
+
+void apm_get_thresholds(apm_thresholds *t)
+{
+    ASSERT(t != NULL);
+    *t = _apm_thresholds;
+}
+
+int apm_set_thresholds(const apm_thresholds *t)
+{
+    ASSERT(t != NULL);
+    for (size_t i = 0; i < N_FIELDS; i++) {
+        if (FIELD_AT(t, i) < fields[i].min)
+            return -1;
+    }
+    _apm_thresholds = *t;
+    return 0;
+}
+
+int apm_load_thresholds(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    apm_thresholds t = _apm_thresholds;
+    char line[256];
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), fp)) {
+        char name[64], *end;
+        int len;
+        line[strcspn(line, "#\n")] = '\0';
+        if (sscanf(line, " %63s %n", name, &len) != 1)
+            continue; /* Blank or comment. */
+        const unsigned long value = strtoul(line + len, &end, 10);
+        while (*end == ' ' || *end == '\t')
+            ++end;
+        size_t i = 0;
+        while (i < N_FIELDS && strcmp(name, fields[i].name))
+            ++i;
+        if (i == N_FIELDS || end == line + len || *end || value > UINT32_MAX)
+            ret = -1;
+        else
+            FIELD_AT(&t, i) = (apm_size) value;
+    }
+    if (ferror(fp))
+        ret = -1;
+    fclose(fp);
+    return ret ? ret : apm_set_thresholds(&t);
+}
+
+int apm_save_thresholds(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+
+    fprintf(fp, "# apm multiplication cutoffs, in digits of %u bits\n",
+            APM_DIGIT_BITS);
+    for (size_t i = 0; i < N_FIELDS; i++)
+        fprintf(fp, "%s %lu\n", fields[i].name,
+                (unsigned long) FIELD_AT(&_apm_thresholds, i));
+    return fclose(fp) ? -1 : 0;
+}
+
+__attribute__((constructor)) static void apm_params_init(void)
+{
+    const char *path = getenv("APM_TUNE");
+    if (path && *path && apm_load_thresholds(path) != 0)
+        fprintf(stderr, "APM_TUNE=%s could not be loaded, ignored.\n", path);
+}
@@ -0,0 +1,287 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "apm.h"
+#include "pool.h"
+
+/* A work-stealing pool of threads [cf. Blumofe & Leiserson, "Scheduling
+ * multithreaded computations by work stealing", JACM 46(5), 1999].
+ *
+ * Every thread of the pool owns a deque of tasks. A thread pushes the tasks it
+ * spawns at the bottom of its own deque and takes them back from there, so
+ * that it works depth-first through its part of the recursion, while idle
+ * threads steal from the top of the other deques, where the oldest and hence
+ * largest tasks wait. A thread waiting for a stolen task runs other tasks
+ * meanwhile instead of blocking; since each of them runs to completion before
+ * the wait goes on, the per-thread arena of temporaries stays in LIFO order.
+ * Threads outside the pool share deque 0.
+ *
+ * The products at the sizes worth spawning take microseconds at least, so the
+ * deques are simply guarded by a mutex each.
+ */
+
+/* Most threads, and most tasks queued by one thread; beyond that, a spawned
+ * task runs at once.
+ */
+#define POOL_MAX_THREADS 256
+#define DEQUE_SIZE 64
+
+typedef struct {
+    pthread_mutex_t lock;
+    atomic_uint top, bottom; /* Tasks in [top, bottom), modulo DEQUE_SIZE. */
+    apm_task *tasks[DEQUE_SIZE];
+} pool_deque;
+
+unsigned int _apm_threads = 1;
+
+static pthread_t *workers;    /* _apm_threads - 1 of them. */
+static pool_deque *deques;    /* One per thread, deques[0] for the others. */
+static atomic_uint queued;    /* Tasks in all deques. */
+static atomic_uint sleepers;  /* Workers waiting for tasks. */
+static bool stopping;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+
+static __thread unsigned int pool_self; /* Deque of this thread. */
+
+static void task_run(apm_task *task)
+{
+    task->fn(task->arg);
+    atomic_store_explicit(&task->done, true, memory_order_release);
+}
+
+/* Take the task at the bottom of deque D if it is TASK, or any task if TASK
+ * is NULL.
+ */
+static apm_task *deque_pop(pool_deque *d, const apm_task *task)
+{
+    apm_task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    const unsigned int top =
+        atomic_load_explicit(&d->top, memory_order_relaxed);
+    unsigned int bottom =
+        atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    if (top != bottom &&
+        (!task || d->tasks[(bottom - 1) % DEQUE_SIZE] == task)) {
+        t = d->tasks[--bottom % DEQUE_SIZE];
+        atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+        atomic_fetch_sub(&queued, 1);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+/* Take the task at the top of deque D, if any. */
+static apm_task *deque_steal(pool_deque *d)
+{
+    /* A racy look first keeps the idle threads off the locks. */
+    if (atomic_load_explicit(&d->top, memory_order_relaxed) ==
+        atomic_load_explicit(&d->bottom, memory_order_relaxed))
+        return NULL;
+
+    apm_task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    const unsigned int top =
+        atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (top != atomic_load_explicit(&d->bottom, memory_order_relaxed)) {
+        t = d->tasks[top % DEQUE_SIZE];
+        atomic_store_explicit(&d->top, top + 1, memory_order_relaxed);
+        atomic_fetch_sub(&queued, 1);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+/* Steal a task from any deque, starting after the own one. */
+static apm_task *pool_steal(void)
+{
+    for (unsigned int i = 1; i <= _apm_threads; i++) {
+        apm_task *t = deque_steal(&deques[(pool_self + i) % _apm_threads]);
+        if (t)
+            return t;
+    }
+    return NULL;
+}
+
+void _apm_task_spawn(apm_task *task, void (*fn)(void *arg), void *arg)
+{
+    task->fn = fn;
+    task->arg = arg;
+    atomic_init(&task->done, false);
+
+    pool_deque *d = &deques[pool_self];
+    pthread_mutex_lock(&d->lock);
+    const unsigned int bottom =
+        atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    if (bottom - atomic_load_explicit(&d->top, memory_order_relaxed) ==
+        DEQUE_SIZE) {
+        pthread_mutex_unlock(&d->lock);
+        task_run(task);
+        return;
+    }
+    d->tasks[bottom % DEQUE_SIZE] = task;
+    atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+    atomic_fetch_add(&queued, 1);
+    pthread_mutex_unlock(&d->lock);
+
+    /* A sleeper counts itself before it checks for tasks, so either it sees
+     * this one, or the signal reaches it. */
+    if (atomic_load(&sleepers)) {
+        pthread_mutex_lock(&pool_lock);
+        pthread_cond_signal(&pool_wake);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+void _apm_task_wait(apm_task *task)
+{
+    if (atomic_load_explicit(&task->done, memory_order_acquire))
+        return;
+    if (deque_pop(&deques[pool_self], task)) {
+        task_run(task);
+        return;
+    }
+
+    /* Stolen: help with the rest of the work until it is done. */
+    while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+        apm_task *t = pool_steal();
+        if (t)
+            task_run(t);
+        else
+            sched_yield();
+    }
+}
+
+typedef struct {
+    void (*fn)(void *arg, size_t lo, size_t hi);
+    void *arg;
+    size_t lo, hi, grain;
+} pool_range;
+
+/* Halve the range until it is small enough, spawning the upper halves. */
+static void range_run(void *arg)
+{
+    const pool_range *r = arg;
+    if (r->hi - r->lo < 2 * r->grain) {
+        r->fn(r->arg, r->lo, r->hi);
+        return;
+    }
+
+    const size_t mid = r->lo + (r->hi - r->lo) / 2;
+    pool_range lower = *r, upper = *r;
+    lower.hi = upper.lo = mid;
+    apm_task task;
+    _apm_task_spawn(&task, range_run, &upper);
+    range_run(&lower);
+    _apm_task_wait(&task);
+}
+
+void _apm_parallel_for(size_t n,
+                       size_t grain,
+                       void (*fn)(void *arg, size_t lo, size_t hi),
+                       void *arg)
+{
+    /* A few ranges per thread even out their running times. */
+    const size_t even = n / (8 * _apm_threads);
+    pool_range r = {fn, arg, 0, n, grain > even ? grain : even};
+    if (_apm_threads == 1 || !r.grain)
+        r.grain = n ? n : 1;
+    range_run(&r);
+}
+
+static void *worker_main(void *arg)
+{
+    pool_self = (unsigned int) (size_t) arg;
+    pool_deque *own = &deques[pool_self];
+    for (;;) {
+        apm_task *t = deque_pop(own, NULL);
+        if (!t)
+            t = pool_steal();
+        if (t) {
+            task_run(t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        atomic_fetch_add(&sleepers, 1);
+        while (!atomic_load(&queued) && !stopping)
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        atomic_fetch_sub(&sleepers, 1);
+        const bool stop = stopping;
+        pthread_mutex_unlock(&pool_lock);
+        if (stop)
+            break;
+    }
+    apm_tmp_trim();
+    return NULL;
+}
+
+/* Stop and join the workers. No task may be pending. */
+static void pool_stop(void)
+{
+    if (_apm_threads == 1)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    stopping = true;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for (unsigned int i = 0; i < _apm_threads - 1; i++)
+        pthread_join(workers[i], NULL);
+    stopping = false;
+
+    for (unsigned int i = 0; i < _apm_threads; i++)
+        pthread_mutex_destroy(&deques[i].lock);
+    FREE(workers);
+    FREE(deques);
+    workers = NULL;
+    deques = NULL;
+    _apm_threads = 1;
+}
+
+int apm_set_threads(unsigned int threads)
+{
+    if (!threads) {
+        const long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (unsigned int) n : 1;
+    }
+    if (threads > POOL_MAX_THREADS)
+        threads = POOL_MAX_THREADS;
+
+    pool_stop();
+    if (threads == 1)
+        return 0;
+
+    deques = MALLOC(threads * sizeof(*deques));
+    workers = MALLOC((threads - 1) * sizeof(*workers));
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        atomic_init(&deques[i].top, 0);
+        atomic_init(&deques[i].bottom, 0);
+    }
+    /* Deque 0 serves the threads outside the pool. */
+    _apm_threads = threads;
+    for (unsigned int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main,
+                           (void *) (size_t) (i + 1)) != 0) {
+            _apm_threads = i + 1;
+            pool_stop();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+unsigned int apm_get_threads(void)
+{
+    return _apm_threads;
+}
+
+__attribute__((constructor)) static void apm_pool_init(void)
+{
+    const char *s = getenv("APM_THREADS");
+    if (s && *s && apm_set_threads(strtoul(s, NULL, 10)) != 0)
+        fprintf(stderr, "APM_THREADS=%s: cannot start the threads.\n", s);
+}
@@ -0,0 +1,65 @@
+/* A work-stealing pool of threads for the independent sub-products of the
+ * multiplication algorithms (see pool.c).
+ */
+
+#ifndef _APM_POOL_H_
+#define _APM_POOL_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "apm.h"
+
+/* A unit of work, which lives with its spawner until _apm_task_wait returns. */
+typedef struct {
+    void (*fn)(void *arg);
+    void *arg;
+    atomic_bool done;
+} apm_task;
+
+/* Number of threads products may use, counting the caller; 1 without a
+ * pool.
+ */
+extern unsigned int _apm_threads;
+
+/* Queue TASK to be run by any thread of the pool, or by the caller itself in
+ * _apm_task_wait. Tasks spawned by a thread MUST be waited for in the reverse
+ * order.
+ */
+void _apm_task_spawn(apm_task *task, void (*fn)(void *arg), void *arg);
+/* Return once TASK has run, running it, or other queued tasks, meanwhile. */
+void _apm_task_wait(apm_task *task);
+
+/* Call fn(arg, lo, hi) for ranges which partition [0, n), in parallel. Ranges
+ * hold at least GRAIN items, unless n is smaller.
+ */
+void _apm_parallel_for(size_t n,
+                       size_t grain,
+                       void (*fn)(void *arg, size_t lo, size_t hi),
+                       void *arg);
+
+/* One of the independent products of a Karatsuba or Toom-Cook step, which
+ * sets w[2 * size] = u[size] * v[size], or u[size]^2 if U == V.
+ */
+typedef struct {
+    const apm_digit *u, *v;
+    apm_size size;
+    apm_digit *w;
+    apm_digit *scratch; /* Set by _apm_mul_jobs. */
+} apm_mul_job;
+
+/* Compute the N products of JOBS in parallel, the first one with the given
+ * SCRATCH space, which is enough for it alone, and the others with space of
+ * their own.
+ */
+void _apm_mul_jobs(apm_mul_job *jobs, unsigned int n, apm_digit *scratch);
+
+/* Whether the sub-products of a size-digit product are worth running in
+ * parallel.
+ */
+static inline bool _apm_parallel_wanted(apm_size size)
+{
+    return _apm_threads > 1 && size >= PARALLEL_THRESHOLD;
+}
+
+#endif /* _APM_POOL_H_ */
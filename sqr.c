@@ -1,15 +1,36 @@
 #include <stdbool.h>
 
 #include "apm.h"
+#include "cpu.h"
+#include "pool.h"
 
 extern void _apm_mul_base(const apm_digit *u,
                           apm_size usize,
                           const apm_digit *v,
                           apm_size vsize,
                           apm_digit *w);
+extern bool _apm_fft_wanted(apm_size vsize, bool sqr);
+extern bool _apm_mul_fft(const apm_digit *u,
+                         apm_size usize,
+                         const apm_digit *v,
+                         apm_size vsize,
+                         apm_digit *w);
+extern bool _apm_toom3_eval(const apm_digit *a,
+                            apm_size k,
+                            apm_size r,
+                            apm_digit *e1,
+                            apm_digit *em1,
+                            apm_digit *e2);
+extern void _apm_toom3_interpolate(apm_digit *w,
+                                   apm_size k,
+                                   apm_size r,
+                                   apm_digit *p1,
+                                   apm_digit *pm1,
+                                   apm_digit *p2,
+                                   bool neg);
 
 /* Square diagonal. */
-static void apm_sqr_diag(const apm_digit *u, apm_size size, apm_digit *v)
+void _apm_sqr_diag_c(const apm_digit *u, apm_size size, apm_digit *v)
 {
     if (!size)
         return;
@@ -34,11 +55,7 @@ static void apm_sqr_diag(const apm_digit *u, apm_size size, apm_digit *v)
     ASSERT(cy == 0);
 }
 
-#ifndef BASE_SQR_THRESHOLD
-#define BASE_SQR_THRESHOLD 10
-#endif /* !BASE_SQR_THRESHOLD */
-
-static void apm_sqr_base(const apm_digit *u, apm_size usize, apm_digit *v)
+void _apm_sqr_base_c(const apm_digit *u, apm_size usize, apm_digit *v)
 {
     if (!usize)
         return;
@@ -87,7 +104,74 @@ static void apm_sqr_base(const apm_digit *u, apm_size usize, apm_digit *v)
     /* Add "main diagonal:"
      * for i=0 .. n-1
      *     v += u[i]^2 * B^2i */
-    apm_sqr_diag(u, usize, v);
+    _apm_kernels.sqr_diag(u, usize, v);
+}
+
+static inline void apm_sqr_base(const apm_digit *u, apm_size size, apm_digit *v)
+{
+    _apm_kernels.sqr_base(u, size, v);
+}
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* As apm_mul_n_scratch_size, for the squaring recursion. */
+apm_size apm_sqr_scratch_size(apm_size size)
+{
+    if (_apm_fft_wanted(size, true) || size < KARATSUBA_SQR_THRESHOLD)
+        return 0;
+
+    if (size >= TOOM3_SQR_THRESHOLD) {
+        const apm_size k = (size + 2) / 3, r = size - 2 * k;
+        apm_size sub =
+            MAX(apm_sqr_scratch_size(k), apm_sqr_scratch_size(k + 1));
+        sub = MAX(sub, apm_sqr_scratch_size(r));
+        return 9 * (k + 1) + sub;
+    }
+
+    const apm_size even_size = size & ~1;
+    return 2 * even_size + apm_sqr_scratch_size(even_size / 2);
+}
+
+/* Toom-Cook 3-way squaring.
+ * This is the multiplication of mul.c with both operands equal: U is only
+ * evaluated once at 0, 1, -1, 2 and infinity, and the five point-wise
+ * products are squares, which recurse into the cheaper squaring routines.
+ * W(-1) is a square as well, hence never negative.
+ */
+static void apm_sqr_toom3(const apm_digit *u,
+                          apm_size size,
+                          apm_digit *v,
+                          apm_digit *scratch)
+{
+    const apm_size k = (size + 2) / 3;
+    const apm_size r = size - 2 * k; /* Size of U2: 0 < r <= k. */
+    const apm_size esize = k + 1;     /* Size of the evaluated operand. */
+    const apm_size psize = 2 * esize; /* Size of the point-wise squares. */
+
+    apm_digit *e1 = scratch, *em1 = e1 + esize, *e2 = em1 + esize;
+    apm_digit *p1 = e2 + esize, *pm1 = p1 + psize, *p2 = pm1 + psize;
+    apm_digit *rest = p2 + psize;
+
+    _apm_toom3_eval(u, k, r, e1, em1, e2);
+
+    /* W(0) => v[0..2k-1], W(inf) => v[4k..] */
+    if (_apm_parallel_wanted(size)) {
+        apm_mul_job jobs[5] = {
+            {e1, e1, esize, p1}, {em1, em1, esize, pm1}, {e2, e2, esize, p2},
+            {u, u, k, v},        {u + 2 * k, u + 2 * k, r, v + 4 * k},
+        };
+        _apm_mul_jobs(jobs, 5, rest);
+    } else {
+        apm_sqr_scratch(u, k, v, rest);
+        apm_sqr_scratch(u + 2 * k, r, v + 4 * k, rest);
+        apm_sqr_scratch(e1, esize, p1, rest);
+        apm_sqr_scratch(em1, esize, pm1, rest);
+        apm_sqr_scratch(e2, esize, p2, rest);
+    }
+
+    _apm_toom3_interpolate(v, k, r, p1, pm1, p2, false);
 }
 
 /* Karatsuba squaring recursively applies the formula:
@@ -97,21 +181,21 @@ static void apm_sqr_base(const apm_digit *u, apm_size usize, apm_digit *v)
  * code formula:
  *		U^2 = (2^2N)U1^2 + (2^(N+1))(U1*U0) + U0^2
  */
-void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
+void apm_sqr_scratch(const apm_digit *u,
+                     apm_size size,
+                     apm_digit *v,
+                     apm_digit *scratch)
 {
-    apm_size rsize = apm_rsize(u, size);
-    if (rsize != size) {
-        apm_zero(v + rsize * 2, (size - rsize) * 2);
-        size = rsize;
+    if (_apm_mul_fft(u, size, u, size, v))
+        return;
+
+    if (size >= TOOM3_SQR_THRESHOLD) {
+        apm_sqr_toom3(u, size, v, scratch);
+        return;
     }
 
     if (size < KARATSUBA_SQR_THRESHOLD) {
-        if (!size)
-            return;
-        if (size <= BASE_SQR_THRESHOLD)
-            _apm_mul_base(u, size, u, size, v);
-        else
-            apm_sqr_base(u, size, v);
+        apm_sqr_base(u, size, v);
         return;
     }
 
@@ -121,32 +205,44 @@ void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
     const apm_digit *u0 = u, *u1 = u + half_size;
     apm_digit *v0 = v, *v1 = v + even_size;
 
-    /* Choose the appropriate squaring function. */
-    void (*sqr_fn)(const apm_digit *, apm_size, apm_digit *) =
-        (half_size >= KARATSUBA_SQR_THRESHOLD) ? apm_sqr : apm_sqr_base;
-    /* Compute the low and high squares, potentially recursively. */
-    sqr_fn(u0, half_size, v0); /* U0^2 => V0 */
-    sqr_fn(u1, half_size, v1); /* U1^2 => V1 */
-
-    apm_digit *tmp = APM_TMP_ALLOC(even_size * 2);
+    /* tmp = |U1-U0|, unless zero. */
+    apm_digit *tmp = scratch;
     apm_digit *tmp2 = tmp + even_size;
+    int cmp = apm_cmp_n(u1, u0, half_size);
+    if (cmp < 0)
+        apm_sub_n(u0, u1, half_size, tmp);
+    else if (cmp > 0)
+        apm_sub_n(u1, u0, half_size, tmp);
+
+    /* U0^2 => V0, U1^2 => V1, (U1-U0)^2 => tmp2, potentially recursively. */
+    if (_apm_parallel_wanted(size)) {
+        apm_mul_job jobs[3] = {
+            {u0, u0, half_size, v0},
+            {u1, u1, half_size, v1},
+            {tmp, tmp, half_size, tmp2},
+        };
+        _apm_mul_jobs(jobs, cmp ? 3 : 2, tmp2 + even_size);
+    } else if (half_size >= KARATSUBA_SQR_THRESHOLD) {
+        apm_sqr_scratch(u0, half_size, v0, tmp2 + even_size);
+        apm_sqr_scratch(u1, half_size, v1, tmp2 + even_size);
+        if (cmp)
+            apm_sqr_scratch(tmp, half_size, tmp2, tmp2 + even_size);
+    } else {
+        apm_sqr_base(u0, half_size, v0);
+        apm_sqr_base(u1, half_size, v1);
+        if (cmp)
+            apm_sqr_base(tmp, half_size, tmp2);
+    }
+
     /* tmp = w[0..even_size-1] */
     apm_copy(v0, even_size, tmp);
     /* v += U1^2 * 2^N */
     apm_digit cy = apm_addi_n(v + half_size, v1, even_size);
     /* v += U0^2 * 2^N */
     cy += apm_addi_n(v + half_size, tmp, even_size);
-
-    int cmp = apm_cmp_n(u1, u0, half_size);
-    if (cmp) {
-        if (cmp < 0)
-            apm_sub_n(u0, u1, half_size, tmp);
-        else
-            apm_sub_n(u1, u0, half_size, tmp);
-        sqr_fn(tmp, half_size, tmp2);
+    /* v -= (U1-U0)^2 * 2^N */
+    if (cmp)
         cy -= apm_subi_n(v + half_size, tmp2, even_size);
-    }
-    APM_TMP_FREE(tmp);
 
     if (cy) {
         ASSERT(apm_daddi(v + even_size + half_size, half_size, cy) == 0);
@@ -159,3 +255,19 @@ void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
             apm_dmul_add(u, size, u[even_size], &v[even_size]);
     }
 }
+
+void apm_sqr(const apm_digit *u, apm_size size, apm_digit *v)
+{
+    apm_size rsize = apm_rsize(u, size);
+    if (rsize != size) {
+        apm_zero(v + rsize * 2, (size - rsize) * 2);
+        size = rsize;
+    }
+
+    /* One buffer serves the whole recursion. */
+    const apm_size scratch_size = apm_sqr_scratch_size(size);
+    apm_digit *scratch = scratch_size ? APM_TMP_ALLOC(scratch_size) : NULL;
+    apm_sqr_scratch(u, size, v, scratch);
+    if (scratch)
+        APM_TMP_FREE(scratch);
+}
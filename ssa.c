@@ -0,0 +1,417 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "apm.h"
+#include "pool.h"
+
+/* Schönhage–Strassen multiplication
+ * [cf. Crandall & Pomerance, "Prime Numbers", 2nd ed, Algorithm 9.5.23]
+ * https://en.wikipedia.org/wiki/Sch%C3%B6nhage%E2%80%93Strassen_algorithm
+ *
+ * The operands are cut into pieces of M bits, which are the coefficients of
+ * two polynomials. Their product is computed as a cyclic convolution of length
+ * K = 2^k over the ring Z/(2^N+1), with N >= 2M + k + 1 so that no coefficient
+ * of the integer product wraps around. In that ring 2 is a 2N-th root of
+ * unity, so as long as K divides 2N every twiddle factor of the transform is a
+ * power of two and the butterflies only need shifts, additions and
+ * subtractions. The K point-wise products of N-bit numbers are handed back to
+ * apm_mul_n_scratch/apm_sqr_scratch, which recurse into this routine when they
+ * are large enough.
+ *
+ * An element of the ring is kept in L+1 digits, L = N / APM_DIGIT_BITS, with
+ * its value normalized to [0, 2^N]; the extra digit is only ever 1 for 2^N.
+ */
+
+typedef struct {
+    unsigned int k;   /* log2 of the transform length. */
+    apm_size piece;   /* Digits per coefficient, M / APM_DIGIT_BITS. */
+    apm_size limbs;   /* Digits per ring element minus one, L. */
+    unsigned int lgw; /* log2 of the principal root of unity, 2N / K. */
+} ssa_params;
+
+/* Rough operation count of an n-digit product, used to choose parameters. */
+static double ssa_mul_cost(apm_size n)
+{
+    if (n < KARATSUBA_MUL_THRESHOLD)
+        return (double) n * n;
+    if (n < TOOM3_MUL_THRESHOLD)
+        return 3 * ssa_mul_cost(n / 2) + 8.0 * n;
+    return 5 * ssa_mul_cost(n / 3 + 1) + 24.0 * n;
+}
+
+/* Choose the transform length which minimizes the estimated cost of the
+ * butterflies plus the point-wise products for a usize by vsize product.
+ */
+static void ssa_choose(apm_size usize, apm_size vsize, ssa_params *p)
+{
+    const size_t total = (size_t) usize + vsize;
+    double best = 0;
+
+    *p = (ssa_params){.k = 0};
+    for (unsigned int k = 4; k <= 24; k++) {
+        const size_t K = (size_t) 1 << k;
+        size_t m = (total + K - 1) / K;
+        while ((usize + m - 1) / m + (vsize + m - 1) / m - 1 > K)
+            ++m;
+        /* N must be a multiple of both the digit size and K/2. */
+        const size_t align = (K / 2 > APM_DIGIT_BITS) ? K / 2 : APM_DIGIT_BITS;
+        const size_t bits = 2 * m * APM_DIGIT_BITS + k + 1;
+        const size_t n = (bits + align - 1) / align * align;
+        const size_t L = n / APM_DIGIT_BITS;
+
+        const double cost =
+            (double) K * (ssa_mul_cost(L) + 6.0 * k * (double) (L + 1));
+        if (p->k == 0 || cost < best) {
+            best = cost;
+            p->k = k;
+            p->piece = m;
+            p->limbs = L;
+            p->lgw = 2 * n / K;
+        }
+        if (m == 1)
+            break;
+    }
+}
+
+/* Reduce a[0..L], whose top digit may exceed 1, modulo 2^N+1. */
+static void ssa_norm(apm_digit *a, apm_size L)
+{
+    apm_digit hi = a[L];
+    a[L] = 0;
+    /* 2^N = -1: subtract the high part from the low part. */
+    if (apm_subi(a, L, &hi, 1))
+        a[L] = apm_daddi(a, L, 1);
+}
+
+/* Set c = a + b mod 2^N+1. */
+static void ssa_add(const apm_digit *a,
+                    const apm_digit *b,
+                    apm_digit *c,
+                    apm_size L)
+{
+    apm_add_n(a, b, L + 1, c);
+    ssa_norm(c, L);
+}
+
+/* Set c = a - b mod 2^N+1. */
+static void ssa_sub(const apm_digit *a,
+                    const apm_digit *b,
+                    apm_digit *c,
+                    apm_size L)
+{
+    if (apm_sub_n(a, b, L + 1, c)) {
+        /* Add 2^N+1 to the negative difference, modulo B^(L+1). */
+        apm_daddi(c, L + 1, 1);
+        c[L] += 1;
+    }
+}
+
+/* Set a = -a mod 2^N+1. */
+static void ssa_neg(apm_digit *a, apm_size L)
+{
+    if (!apm_rsize(a, L + 1))
+        return;
+    /* 2^N+1 - a = ~a + 1 + (2^N+1) modulo B^(L+1). */
+    for (apm_size i = 0; i <= L; i++)
+        a[i] = ~a[i];
+    apm_daddi(a, L + 1, 2);
+    a[L] += 1;
+}
+
+/* Set c = a * 2^shift mod 2^N+1, with 0 <= shift < 2N. TMP holds 2L+2 digits;
+ * C may alias A.
+ */
+static void ssa_mul_2exp(const apm_digit *a,
+                         size_t shift,
+                         apm_digit *c,
+                         apm_size L,
+                         apm_digit *tmp)
+{
+    const size_t n = (size_t) L * APM_DIGIT_BITS;
+    const bool neg = shift >= n;
+    if (neg)
+        shift -= n;
+
+    const apm_size d = shift / APM_DIGIT_BITS;
+    apm_zero(tmp, 2 * L + 2);
+    tmp[d + L + 1] = apm_lshift(a, L + 1, shift % APM_DIGIT_BITS, tmp + d);
+    ASSERT(tmp[2 * L + 1] == 0);
+
+    /* a * 2^shift = hi * 2^N + lo = lo - hi. */
+    apm_copy(tmp, L, c);
+    c[L] = 0;
+    ssa_sub(c, tmp + L, c, L);
+    if (neg)
+        ssa_neg(c, L);
+}
+
+/* One stage of butterflies of a transform, on blocks of LEN elements. */
+typedef struct {
+    apm_digit *a;
+    const ssa_params *p;
+    size_t len, lgw;
+} ssa_stage;
+
+/* Run the butterflies of index [lo, hi) of a forward stage: decimation in
+ * frequency, with the twiddle factors applied after the butterflies. TMP
+ * holds 3L+3 digits.
+ */
+static void ssa_fft_range(const ssa_stage *st,
+                          size_t lo,
+                          size_t hi,
+                          apm_digit *tmp)
+{
+    const apm_size L = st->p->limbs, stride = L + 1;
+    const size_t half = st->len / 2;
+    apm_digit *t = tmp, *t2 = tmp + stride;
+
+    for (size_t b = lo; b < hi; b++) {
+        const size_t s = b / half * st->len, j = b % half;
+        apm_digit *x = st->a + (s + j) * stride;
+        apm_digit *y = x + half * stride;
+        ssa_sub(x, y, t, L);
+        ssa_add(x, y, x, L);
+        ssa_mul_2exp(t, j * st->lgw, y, L, t2);
+    }
+}
+
+/* As ssa_fft_range, for an inverse stage: decimation in time, with the
+ * inverse twiddle factors 2^(2N - e) applied before the butterflies.
+ */
+static void ssa_ifft_range(const ssa_stage *st,
+                           size_t lo,
+                           size_t hi,
+                           apm_digit *tmp)
+{
+    const apm_size L = st->p->limbs, stride = L + 1;
+    const size_t half = st->len / 2;
+    const size_t n2 = 2 * (size_t) L * APM_DIGIT_BITS;
+    apm_digit *t = tmp, *t2 = tmp + stride;
+
+    for (size_t b = lo; b < hi; b++) {
+        const size_t s = b / half * st->len, j = b % half;
+        apm_digit *x = st->a + (s + j) * stride;
+        apm_digit *y = x + half * stride;
+        if (j)
+            ssa_mul_2exp(y, n2 - j * st->lgw, y, L, t2);
+        ssa_sub(x, y, t, L);
+        ssa_add(x, y, x, L);
+        apm_copy(t, stride, y);
+    }
+}
+
+/* Ranges of butterflies run by other threads, with space of their own. */
+static void ssa_fft_task(void *arg, size_t lo, size_t hi)
+{
+    const ssa_stage *st = arg;
+    apm_digit *tmp = APM_TMP_ALLOC(3 * (st->p->limbs + 1));
+    ssa_fft_range(st, lo, hi, tmp);
+    APM_TMP_FREE(tmp);
+}
+
+static void ssa_ifft_task(void *arg, size_t lo, size_t hi)
+{
+    const ssa_stage *st = arg;
+    apm_digit *tmp = APM_TMP_ALLOC(3 * (st->p->limbs + 1));
+    ssa_ifft_range(st, lo, hi, tmp);
+    APM_TMP_FREE(tmp);
+}
+
+/* Butterflies per range of a parallel stage: enough digits to be worth a
+ * task.
+ */
+static size_t ssa_grain(const ssa_params *p)
+{
+    return 16384 / (p->limbs + 1) + 1;
+}
+
+/* Forward transform, from natural order input to bit-reversed output. The
+ * butterflies of each stage are independent, so with PAR they are spread over
+ * the threads. TMP holds 3L+3 digits.
+ */
+static void ssa_fft(apm_digit *a,
+                    const ssa_params *p,
+                    bool par,
+                    apm_digit *tmp)
+{
+    const size_t K = (size_t) 1 << p->k;
+
+    for (size_t len = K, lgw = p->lgw; len >= 2; len >>= 1, lgw <<= 1) {
+        ssa_stage st = {a, p, len, lgw};
+        if (par)
+            _apm_parallel_for(K / 2, ssa_grain(p), ssa_fft_task, &st);
+        else
+            ssa_fft_range(&st, 0, K / 2, tmp);
+    }
+}
+
+/* Inverse transform, from bit-reversed order input to natural output, scaled
+ * by K. TMP holds 3L+3 digits.
+ */
+static void ssa_ifft(apm_digit *a,
+                     const ssa_params *p,
+                     bool par,
+                     apm_digit *tmp)
+{
+    const size_t K = (size_t) 1 << p->k;
+
+    size_t lgw = p->lgw * K / 2;
+    for (size_t len = 2; len <= K; len <<= 1, lgw >>= 1) {
+        ssa_stage st = {a, p, len, lgw};
+        if (par)
+            _apm_parallel_for(K / 2, ssa_grain(p), ssa_ifft_task, &st);
+        else
+            ssa_ifft_range(&st, 0, K / 2, tmp);
+    }
+}
+
+/* Cut u[usize] into coefficients of p->piece digits, zero-padded to K. */
+static void ssa_split(const apm_digit *u,
+                      apm_size usize,
+                      apm_digit *a,
+                      const ssa_params *p)
+{
+    const apm_size stride = p->limbs + 1;
+    const size_t K = (size_t) 1 << p->k;
+
+    apm_zero(a, K * stride);
+    for (apm_size i = 0; usize; i++, a += stride) {
+        const apm_size n = usize < p->piece ? usize : p->piece;
+        apm_copy(u, n, a);
+        u += n;
+        usize -= n;
+    }
+}
+
+/* Set c = a * b mod 2^N+1, or c = a^2 if A == B. PROD holds 2L+1 digits,
+ * followed by the scratch space of the multiplication.
+ */
+static void ssa_pointwise(const apm_digit *a,
+                          const apm_digit *b,
+                          apm_digit *c,
+                          apm_size L,
+                          apm_digit *prod)
+{
+    /* 2^N = -1, whose product with anything is a negation. */
+    if (a[L] || b[L]) {
+        if (a[L] && b[L]) {
+            apm_zero(c, L + 1);
+            c[0] = 1;
+        } else {
+            apm_copy(a[L] ? b : a, L + 1, c);
+            ssa_neg(c, L);
+        }
+        return;
+    }
+
+    if (a == b)
+        apm_sqr_scratch(a, L, prod, prod + 2 * L + 1);
+    else
+        apm_mul_n_scratch(a, b, L, prod, prod + 2 * L + 1);
+    prod[2 * L] = 0;
+    /* hi * 2^N + lo = lo - hi. */
+    apm_copy(prod, L, c);
+    c[L] = 0;
+    ssa_sub(c, prod + L, c, L);
+}
+
+/* The point-wise products of a range of coefficients, in a buffer of their
+ * own.
+ */
+typedef struct {
+    apm_digit *a, *b;
+    apm_size limbs;
+    bool sqr;
+} ssa_products;
+
+static void ssa_pointwise_task(void *arg, size_t lo, size_t hi)
+{
+    const ssa_products *pp = arg;
+    const apm_size L = pp->limbs, stride = L + 1;
+    const apm_size scratch_size =
+        pp->sqr ? apm_sqr_scratch_size(L) : apm_mul_n_scratch_size(L);
+    apm_digit *prod = APM_TMP_ALLOC(2 * L + 1 + scratch_size);
+    for (size_t i = lo; i < hi; i++) {
+        ssa_pointwise(pp->a + i * stride, pp->b + i * stride,
+                      pp->a + i * stride, L, prod);
+    }
+    APM_TMP_FREE(prod);
+}
+
+/* Divide coefficients [lo, hi) by K. */
+typedef struct {
+    apm_digit *a;
+    const ssa_params *p;
+} ssa_coeffs;
+
+static void ssa_scale_task(void *arg, size_t lo, size_t hi)
+{
+    const ssa_coeffs *c = arg;
+    const apm_size L = c->p->limbs, stride = L + 1;
+    const size_t n2 = 2 * (size_t) L * APM_DIGIT_BITS;
+    apm_digit *tmp = APM_TMP_ALLOC(2 * stride);
+    for (size_t i = lo; i < hi; i++)
+        ssa_mul_2exp(c->a + i * stride, n2 - c->p->k, c->a + i * stride, L,
+                     tmp);
+    APM_TMP_FREE(tmp);
+}
+
+/* Set w[usize + vsize] = u[usize] * v[vsize] with Schönhage–Strassen, where
+ * U == V (and usize == vsize) selects the squaring variant, which needs only
+ * one forward transform. Above the parallel cutoff, the butterflies and the
+ * point-wise products are spread over the threads.
+ */
+void _apm_mul_ssa(const apm_digit *u,
+                  apm_size usize,
+                  const apm_digit *v,
+                  apm_size vsize,
+                  apm_digit *w)
+{
+    const bool sqr = (u == v && usize == vsize);
+    const bool par = _apm_parallel_wanted(usize < vsize ? usize : vsize);
+    ssa_params p;
+    ssa_choose(usize, vsize, &p);
+
+    const apm_size L = p.limbs, stride = L + 1;
+    const size_t K = (size_t) 1 << p.k;
+
+    apm_digit *a = APM_TMP_ALLOC(K * stride * (sqr ? 1 : 2) + 3 * stride);
+    apm_digit *b = sqr ? a : a + K * stride;
+    apm_digit *tmp = b + K * stride;
+
+    ssa_split(u, usize, a, &p);
+    ssa_fft(a, &p, par, tmp);
+    if (!sqr) {
+        ssa_split(v, vsize, b, &p);
+        ssa_fft(b, &p, par, tmp);
+    }
+
+    /* The point-wise products may recurse, so they get their own buffer. */
+    ssa_products pp = {a, b, L, sqr};
+    if (par)
+        _apm_parallel_for(K, 1, ssa_pointwise_task, &pp);
+    else
+        ssa_pointwise_task(&pp, 0, K);
+
+    ssa_ifft(a, &p, par, tmp);
+
+    /* Divide by K, then add the coefficients up at their digit offsets. */
+    const size_t wsize = (size_t) usize + vsize;
+    const size_t used = (wsize + p.piece - 1) / p.piece;
+    ssa_coeffs coeffs = {a, &p};
+    if (par)
+        _apm_parallel_for(used < K ? used : K, ssa_grain(&p), ssa_scale_task,
+                          &coeffs);
+    else
+        ssa_scale_task(&coeffs, 0, used < K ? used : K);
+
+    apm_zero(w, wsize);
+    for (size_t i = 0, off = 0; i < K && off < wsize; i++, off += p.piece) {
+        apm_digit *c = a + i * stride;
+        const apm_size csize = apm_rsize(c, stride);
+        if (csize) {
+            ASSERT(apm_addi(w + off, wsize - off, c, csize) == 0);
+        }
+    }
+    APM_TMP_FREE(a);
+}
@@ -0,0 +1,216 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "apm.h"
+
+/* Measure the cutoffs between the multiplication algorithms on this host.
+ *
+ * Usage: tuneup [header [profile]]
+ * Each cutoff is found by timing apm_mul or apm_sqr at growing operand sizes
+ * twice, once with the cutoff just above the size and once at it, so that only
+ * the top level of the recursion changes algorithm while the levels below use
+ * the cutoffs measured so far. The cutoff is the first size from which the
+ * faster algorithm wins several times in a row, which keeps one noisy sample
+ * from deciding it. The results are printed, and written as #defines to
+ * HEADER (see apm_internal.h) and as a profile for APM_TUNE to PROFILE.
+ *
+ * The cutoffs depend on the kernel set, so run this with the one that will be
+ * used (see APM_CPU).
+ */
+
+/* Consecutive wins which settle a cutoff. */
+#define WINS 3
+
+/* Timing runs per configuration, and the least duration of each. */
+#define RUNS 7
+#define RUN_TIME 0.005
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(apm_digit *u, apm_size size, uint64_t seed)
+{
+    for (apm_size i = 0; i < size; i++) {
+        /* xorshift64 */
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        u[i] = (apm_digit) seed;
+    }
+}
+
+static apm_digit *u, *v, *w;
+
+/* Time one run of products of size digits, or squares if SQR, and lower
+ * *BEST to the time per product, in seconds.
+ */
+static void time_run(apm_size size, bool sqr, double *best)
+{
+    int reps = 0;
+    double elapsed;
+    const double start = now();
+    do {
+        if (sqr)
+            apm_sqr(u, size, w);
+        else
+            apm_mul(u, size, v, size, w);
+        reps++;
+    } while ((elapsed = now() - start) < RUN_TIME);
+    if (*best == 0 || elapsed / reps < *best)
+        *best = elapsed / reps;
+}
+
+/* Find the least size in [lo, hi] from which setting *CUTOFF to the size beats
+ * setting it just above, stepping by at least 1/STEP of the size. If
+ * INVERTED, the cutoff is the largest size still using the old algorithm, so
+ * the new one is timed with the cutoff just below the size, and the result is
+ * the last size at which it lost. Returns hi if there is no crossover in
+ * range.
+ */
+static apm_size find_cutoff(const char *name,
+                            apm_size *cutoff,
+                            apm_size lo,
+                            apm_size hi,
+                            unsigned int step,
+                            bool sqr,
+                            bool inverted)
+{
+    apm_size first = 0;
+    int wins = 0;
+
+    printf("%s:", name);
+    fflush(stdout);
+    for (apm_size n = lo; n <= hi; n += n / step > 1 ? n / step : 1) {
+        /* Alternate the runs, so that a slow spell of the host does not
+         * fall on one configuration only. */
+        double old_time = 0, new_time = 0;
+        for (int run = 0; run < RUNS; run++) {
+            *cutoff = inverted ? n : n + 1;
+            time_run(n, sqr, &old_time);
+            *cutoff = inverted ? n - 1 : n;
+            time_run(n, sqr, &new_time);
+        }
+
+        if (new_time < old_time) {
+            if (wins++ == 0)
+                first = n;
+            if (wins == WINS) {
+                const apm_size found = inverted ? first - 1 : first;
+                printf(" %u\n", (unsigned int) found);
+                *cutoff = found;
+                return found;
+            }
+        } else {
+            wins = 0;
+        }
+    }
+    printf(" %u (no crossover found)\n", (unsigned int) hi);
+    *cutoff = hi;
+    return hi;
+}
+
+static const struct {
+    const char *name;
+    size_t offset;
+} fields[] = {
+#define FIELD(name) {#name, offsetof(apm_thresholds, name)}
+    FIELD(base_sqr),  FIELD(karatsuba_mul), FIELD(karatsuba_sqr),
+    FIELD(toom3_mul), FIELD(toom3_sqr),     FIELD(ssa_mul),
+    FIELD(ssa_sqr),   FIELD(ntt_mul),       FIELD(ntt_sqr),
+    FIELD(parallel),
+#undef FIELD
+};
+
+#define N_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+static int write_header(const char *path, const apm_thresholds *t)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+
+    fprintf(fp,
+            "/* Generated by tuneup with the \"%s\" kernels; see "
+            "apm_internal.h. */\n"
+            "#ifndef _APM_TUNED_H_\n"
+            "#define _APM_TUNED_H_\n\n",
+            apm_get_cpu());
+    for (size_t i = 0; i < N_FIELDS; i++) {
+        char macro[32];
+        size_t j;
+        for (j = 0; fields[i].name[j]; j++)
+            macro[j] = toupper((unsigned char) fields[i].name[j]);
+        macro[j] = '\0';
+        fprintf(fp, "#define %s_DEFAULT %u\n", macro,
+                (unsigned int) *(const apm_size *) ((const char *) t +
+                                                    fields[i].offset));
+    }
+    fprintf(fp, "\n#endif /* _APM_TUNED_H_ */\n");
+    return fclose(fp) ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Large enough for the Schönhage–Strassen and NTT searches. */
+    const apm_size max_size = 1 << 17;
+    u = apm_new(max_size);
+    v = apm_new(max_size);
+    w = apm_new(2 * max_size);
+    fill(u, max_size, 0x9E3779B97F4A7C15);
+    fill(v, max_size, 0xD1B54A32D192ED03);
+
+    printf("kernels: %s\n", apm_get_cpu());
+
+    /* Start from the basecase everywhere, and open one tier at a time. */
+    apm_thresholds t;
+    apm_get_thresholds(&t);
+    t.karatsuba_mul = t.karatsuba_sqr = max_size;
+    t.toom3_mul = t.toom3_sqr = max_size;
+    t.ssa_mul = t.ssa_sqr = t.ntt_mul = t.ntt_sqr = max_size;
+    apm_set_thresholds(&t);
+    apm_set_fft_backend(APM_FFT_NONE);
+
+    apm_thresholds *const th = &_apm_thresholds;
+    find_cutoff("base_sqr", &th->base_sqr, 2, 256, 16, true, true);
+    find_cutoff("karatsuba_mul", &th->karatsuba_mul, 4, 1024, 16, false,
+                false);
+    find_cutoff("karatsuba_sqr", &th->karatsuba_sqr, 4, 1024, 16, true,
+                false);
+    find_cutoff("toom3_mul", &th->toom3_mul,
+                th->karatsuba_mul > 5 ? th->karatsuba_mul : 5, 4096, 16,
+                false, false);
+    find_cutoff("toom3_sqr", &th->toom3_sqr,
+                th->karatsuba_sqr > 5 ? th->karatsuba_sqr : 5, 4096, 16, true,
+                false);
+
+    /* Each transform takes over from the Toom-Cook ladder. */
+    apm_set_fft_backend(APM_FFT_SSA);
+    find_cutoff("ssa_mul", &th->ssa_mul, 256, max_size, 8, false, false);
+    find_cutoff("ssa_sqr", &th->ssa_sqr, 256, max_size, 8, true, false);
+    apm_set_fft_backend(APM_FFT_NTT);
+    find_cutoff("ntt_mul", &th->ntt_mul, 256, max_size, 8, false, false);
+    find_cutoff("ntt_sqr", &th->ntt_sqr, 256, max_size, 8, true, false);
+
+    int ret = 0;
+    if (argc > 1 && write_header(argv[1], th) != 0) {
+        fprintf(stderr, "Cannot write %s\n", argv[1]);
+        ret = 1;
+    }
+    if (argc > 2 && apm_save_thresholds(argv[2]) != 0) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        ret = 1;
+    }
+
+    apm_free(u);
+    apm_free(v);
+    apm_free(w);
+    return ret;
+}
@@ -0,0 +1,330 @@
+#include "apm.h"
+#include "cpu.h"
+
+/* Hand-written x86-64 kernels for the primitives which dominate the basecase
+ * products, replacing the portable versions in apm.c.
+ *
+ * The additions keep the carry in the flags register for the whole loop, which
+ * no compiler manages from the C code; loop control only uses instructions
+ * which leave CF alone (lea, dec, jrcxz). The multiply-accumulate kernels use
+ * MULX, which does not touch the flags, together with ADCX and ADOX, which
+ * propagate two independent carry chains through CF and OF
+ * [cf. Gopal et al., "Fast multiplication with ADCX/ADOX", Intel, 2012].
+ *
+ * The assembler accepts these instructions whatever the compiler flags, so all
+ * kernels are always built; cpu.c only installs the ones the processor
+ * supports.
+ */
+
+#if APM_ASM_X86_64
+
+/* Set w[size] = u[size] + v[size] and return the carry. */
+apm_digit _apm_add_n_x86_64(const apm_digit *u,
+                            const apm_digit *v,
+                            apm_size size,
+                            apm_digit *w)
+{
+    ASSERT(u != NULL);
+    ASSERT(v != NULL);
+    ASSERT(w != NULL);
+
+    size_t n = size & 3;
+    const size_t blocks = size >> 2;
+    apm_digit cy, t0, t1, t2, t3;
+    __asm__ volatile(
+        "xor %k[cy], %k[cy]\n\t"
+        "jrcxz 2f\n"
+        "1:\n\t"
+        "mov (%[u]), %[t0]\n\t"
+        "adc (%[v]), %[t0]\n\t"
+        "mov %[t0], (%[w])\n\t"
+        "lea 8(%[u]), %[u]\n\t"
+        "lea 8(%[v]), %[v]\n\t"
+        "lea 8(%[w]), %[w]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "mov %[blocks], %[n]\n\t"
+        "jrcxz 4f\n"
+        "3:\n\t"
+        "mov (%[u]), %[t0]\n\t"
+        "mov 8(%[u]), %[t1]\n\t"
+        "mov 16(%[u]), %[t2]\n\t"
+        "mov 24(%[u]), %[t3]\n\t"
+        "adc (%[v]), %[t0]\n\t"
+        "adc 8(%[v]), %[t1]\n\t"
+        "adc 16(%[v]), %[t2]\n\t"
+        "adc 24(%[v]), %[t3]\n\t"
+        "mov %[t0], (%[w])\n\t"
+        "mov %[t1], 8(%[w])\n\t"
+        "mov %[t2], 16(%[w])\n\t"
+        "mov %[t3], 24(%[w])\n\t"
+        "lea 32(%[u]), %[u]\n\t"
+        "lea 32(%[v]), %[v]\n\t"
+        "lea 32(%[w]), %[w]\n\t"
+        "dec %[n]\n\t"
+        "jnz 3b\n"
+        "4:\n\t"
+        "setc %b[cy]"
+        : [u] "+r"(u), [v] "+r"(v), [w] "+r"(w), [n] "+c"(n), [cy] "=&r"(cy),
+          [t0] "=&r"(t0), [t1] "=&r"(t1), [t2] "=&r"(t2), [t3] "=&r"(t3)
+        : [blocks] "r"(blocks)
+        : "cc", "memory");
+    return cy;
+}
+
+/* Set w[size] = u[size] - v[size] and return the borrow. */
+apm_digit _apm_sub_n_x86_64(const apm_digit *u,
+                            const apm_digit *v,
+                            apm_size size,
+                            apm_digit *w)
+{
+    ASSERT(u != NULL);
+    ASSERT(v != NULL);
+    ASSERT(w != NULL);
+
+    size_t n = size & 3;
+    const size_t blocks = size >> 2;
+    apm_digit cy, t0, t1, t2, t3;
+    __asm__ volatile(
+        "xor %k[cy], %k[cy]\n\t"
+        "jrcxz 2f\n"
+        "1:\n\t"
+        "mov (%[u]), %[t0]\n\t"
+        "sbb (%[v]), %[t0]\n\t"
+        "mov %[t0], (%[w])\n\t"
+        "lea 8(%[u]), %[u]\n\t"
+        "lea 8(%[v]), %[v]\n\t"
+        "lea 8(%[w]), %[w]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "mov %[blocks], %[n]\n\t"
+        "jrcxz 4f\n"
+        "3:\n\t"
+        "mov (%[u]), %[t0]\n\t"
+        "mov 8(%[u]), %[t1]\n\t"
+        "mov 16(%[u]), %[t2]\n\t"
+        "mov 24(%[u]), %[t3]\n\t"
+        "sbb (%[v]), %[t0]\n\t"
+        "sbb 8(%[v]), %[t1]\n\t"
+        "sbb 16(%[v]), %[t2]\n\t"
+        "sbb 24(%[v]), %[t3]\n\t"
+        "mov %[t0], (%[w])\n\t"
+        "mov %[t1], 8(%[w])\n\t"
+        "mov %[t2], 16(%[w])\n\t"
+        "mov %[t3], 24(%[w])\n\t"
+        "lea 32(%[u]), %[u]\n\t"
+        "lea 32(%[v]), %[v]\n\t"
+        "lea 32(%[w]), %[w]\n\t"
+        "dec %[n]\n\t"
+        "jnz 3b\n"
+        "4:\n\t"
+        "setc %b[cy]"
+        : [u] "+r"(u), [v] "+r"(v), [w] "+r"(w), [n] "+c"(n), [cy] "=&r"(cy),
+          [t0] "=&r"(t0), [t1] "=&r"(t1), [t2] "=&r"(t2), [t3] "=&r"(t3)
+        : [blocks] "r"(blocks)
+        : "cc", "memory");
+    return cy;
+}
+
+/* Multiply u[size] by 2^shift and store in v[size], returning carry.
+ * shift will be taken modulo APM_DIGIT_BITS. */
+apm_digit apm_lshift(const apm_digit *u,
+                     apm_size size,
+                     unsigned int shift,
+                     apm_digit *v)
+{
+    if (!size)
+        return 0;
+
+    shift &= APM_DIGIT_BITS - 1;
+    if (!shift) {
+        if (u != v)
+            apm_copy(u, size, v);
+        return 0;
+    }
+
+    /* shld shifts the next digit in from the previous one. */
+    size_t n = size;
+    apm_digit prev, cur, t;
+    __asm__ volatile(
+        "xor %k[prev], %k[prev]\n"
+        "1:\n\t"
+        "mov (%[u]), %[cur]\n\t"
+        "mov %[cur], %[t]\n\t"
+        "shld %%cl, %[prev], %[t]\n\t"
+        "mov %[t], (%[v])\n\t"
+        "mov %[cur], %[prev]\n\t"
+        "lea 8(%[u]), %[u]\n\t"
+        "lea 8(%[v]), %[v]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "xor %k[t], %k[t]\n\t"
+        "shld %%cl, %[prev], %[t]"
+        : [u] "+r"(u), [v] "+r"(v), [n] "+r"(n), [prev] "=&r"(prev),
+          [cur] "=&r"(cur), [t] "=&r"(t)
+        : "c"(shift)
+        : "cc", "memory");
+    return t;
+}
+
+/* The kernels below use MULX from BMI2; the multiply-accumulate ones also
+ * use ADCX and ADOX from ADX. */
+
+/* Set w[size] = u[size] * v and return the carry. */
+apm_digit _apm_dmul_adx(const apm_digit *u,
+                        apm_size size,
+                        apm_digit v,
+                        apm_digit *w)
+{
+    if (v <= 1) {
+        if (v == 0)
+            apm_zero(w, size);
+        else
+            apm_copy(u, size, w);
+        return 0;
+    }
+
+    /* The high half of each product is added to the next low half through
+     * the carry flag. */
+    size_t n = size & 3;
+    const size_t blocks = size >> 2;
+    apm_digit cy, l0, l1, h0;
+    __asm__ volatile(
+        "xor %k[cy], %k[cy]\n\t"
+        "jrcxz 2f\n"
+        "1:\n\t"
+        "mulx (%[u]), %[l0], %[h0]\n\t"
+        "adcx %[cy], %[l0]\n\t"
+        "mov %[l0], (%[w])\n\t"
+        "mov %[h0], %[cy]\n\t"
+        "lea 8(%[u]), %[u]\n\t"
+        "lea 8(%[w]), %[w]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "mov %[blocks], %[n]\n\t"
+        "jrcxz 4f\n"
+        "3:\n\t"
+        "mulx (%[u]), %[l0], %[h0]\n\t"
+        "adcx %[cy], %[l0]\n\t"
+        "mulx 8(%[u]), %[l1], %[cy]\n\t"
+        "adcx %[h0], %[l1]\n\t"
+        "mov %[l0], (%[w])\n\t"
+        "mov %[l1], 8(%[w])\n\t"
+        "mulx 16(%[u]), %[l0], %[h0]\n\t"
+        "adcx %[cy], %[l0]\n\t"
+        "mulx 24(%[u]), %[l1], %[cy]\n\t"
+        "adcx %[h0], %[l1]\n\t"
+        "mov %[l0], 16(%[w])\n\t"
+        "mov %[l1], 24(%[w])\n\t"
+        "lea 32(%[u]), %[u]\n\t"
+        "lea 32(%[w]), %[w]\n\t"
+        "dec %[n]\n\t"
+        "jnz 3b\n"
+        "4:\n\t"
+        "adc $0, %[cy]"
+        : [u] "+r"(u), [w] "+r"(w), [n] "+c"(n), [cy] "=&r"(cy),
+          [l0] "=&r"(l0), [l1] "=&r"(l1), [h0] "=&r"(h0)
+        : [blocks] "r"(blocks), "d"(v)
+        : "cc", "memory");
+    return cy;
+}
+
+/* Set w[size] = w[size] + u[size] * v and return the carry. */
+apm_digit _apm_dmul_add_adx(const apm_digit *u,
+                            apm_size size,
+                            apm_digit v,
+                            apm_digit *w)
+{
+    ASSERT(u != NULL);
+    ASSERT(w != NULL);
+
+    if (v <= 1)
+        return v ? apm_addi_n(w, u, size) : 0;
+
+    /* ADCX chains the high halves of the products through CF, ADOX the
+     * digits of w through OF. Since dec would clobber OF, the loops count
+     * with lea and test with jrcxz. */
+    size_t n = size & 3;
+    const size_t blocks = size >> 2;
+    apm_digit cy, l0, l1, h0;
+    __asm__ volatile(
+        "xor %k[cy], %k[cy]\n"
+        "1:\n\t"
+        "jrcxz 2f\n\t"
+        "mulx (%[u]), %[l0], %[h0]\n\t"
+        "adcx %[cy], %[l0]\n\t"
+        "adox (%[w]), %[l0]\n\t"
+        "mov %[l0], (%[w])\n\t"
+        "mov %[h0], %[cy]\n\t"
+        "lea 8(%[u]), %[u]\n\t"
+        "lea 8(%[w]), %[w]\n\t"
+        "lea -1(%[n]), %[n]\n\t"
+        "jmp 1b\n"
+        "2:\n\t"
+        "mov %[blocks], %[n]\n"
+        "3:\n\t"
+        "jrcxz 4f\n\t"
+        "mulx (%[u]), %[l0], %[h0]\n\t"
+        "adcx %[cy], %[l0]\n\t"
+        "adox (%[w]), %[l0]\n\t"
+        "mulx 8(%[u]), %[l1], %[cy]\n\t"
+        "adcx %[h0], %[l1]\n\t"
+        "adox 8(%[w]), %[l1]\n\t"
+        "mov %[l0], (%[w])\n\t"
+        "mov %[l1], 8(%[w])\n\t"
+        "mulx 16(%[u]), %[l0], %[h0]\n\t"
+        "adcx %[cy], %[l0]\n\t"
+        "adox 16(%[w]), %[l0]\n\t"
+        "mulx 24(%[u]), %[l1], %[cy]\n\t"
+        "adcx %[h0], %[l1]\n\t"
+        "adox 24(%[w]), %[l1]\n\t"
+        "mov %[l0], 16(%[w])\n\t"
+        "mov %[l1], 24(%[w])\n\t"
+        "lea 32(%[u]), %[u]\n\t"
+        "lea 32(%[w]), %[w]\n\t"
+        "lea -1(%[n]), %[n]\n\t"
+        "jmp 3b\n"
+        "4:\n\t"
+        "mov $0, %k[l0]\n\t"
+        "adcx %[l0], %[cy]\n\t"
+        "adox %[l0], %[cy]"
+        : [u] "+r"(u), [w] "+r"(w), [n] "+c"(n), [cy] "=&r"(cy),
+          [l0] "=&r"(l0), [l1] "=&r"(l1), [h0] "=&r"(h0)
+        : [blocks] "r"(blocks), "d"(v)
+        : "cc", "memory");
+    return cy;
+}
+
+/* Set v[2 * size] = v[2 * size] + u[i]^2 * B^(2i) for i < size, where the sum
+ * MUST fit.
+ */
+void _apm_sqr_diag_bmi2(const apm_digit *u, apm_size size, apm_digit *v)
+{
+    if (!size)
+        return;
+
+    size_t n = size;
+    apm_digit cy, lo, hi;
+    __asm__ volatile(
+        "xor %k[cy], %k[cy]\n"
+        "1:\n\t"
+        "mov (%[u]), %%rdx\n\t"
+        "mulx %%rdx, %[lo], %[hi]\n\t"
+        "adc %[lo], (%[v])\n\t"
+        "adc %[hi], 8(%[v])\n\t"
+        "lea 8(%[u]), %[u]\n\t"
+        "lea 16(%[v]), %[v]\n\t"
+        "dec %[n]\n\t"
+        "jnz 1b\n\t"
+        "setc %b[cy]"
+        : [u] "+r"(u), [v] "+r"(v), [n] "+r"(n), [cy] "=&r"(cy),
+          [lo] "=&r"(lo), [hi] "=&r"(hi)
+        :
+        : "rdx", "cc", "memory");
+    ASSERT(cy == 0);
+}
+
+#endif /* APM_ASM_X86_64 */